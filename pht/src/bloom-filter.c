@@ -0,0 +1,109 @@
+#include "bloom-filter.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Every key maps to a single 64 byte block (one cache line), and all of its
+   bits are set inside that block. A lookup therefore costs at most one cache
+   miss, no matter how many bits we check. */
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 6
+
+struct bloom_block {
+	_Atomic uint64_t words[BLOOM_BLOCK_WORDS];
+};
+
+struct bloom_filter {
+	size_t block_mask;
+	struct bloom_block *blocks;
+};
+
+/* The tables pick a bucket from `bernstein_hash`, so the filter needs an
+   independent hash or every key in a bucket would also share a block. This
+   is 64 bit FNV-1a. */
+static uint64_t fnv1a_hash(const char *string)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+	for (size_t i = 0; string[i] != 0; ++i) {
+		hash ^= (unsigned char) string[i];
+		hash *= UINT64_C(1099511628211);
+	}
+	return hash;
+}
+
+struct bloom_filter *bloom_filter_create(size_t expected_entries)
+{
+	struct bloom_filter *filter = calloc(1, sizeof(struct bloom_filter));
+	assert(filter != NULL);
+
+	size_t bits = expected_entries * BLOOM_BITS_PER_KEY;
+	size_t blocks = 1;
+	while (blocks * BLOOM_BLOCK_BITS < bits) {
+		blocks *= 2;
+	}
+	filter->block_mask = blocks - 1;
+	filter->blocks = aligned_alloc(sizeof(struct bloom_block),
+	                               blocks * sizeof(struct bloom_block));
+	assert(filter->blocks != NULL);
+	for (size_t i = 0; i < blocks; ++i) {
+		for (size_t j = 0; j < BLOOM_BLOCK_WORDS; ++j) {
+			atomic_init(&filter->blocks[i].words[j], 0);
+		}
+	}
+	return filter;
+}
+
+/* The low half of the hash picks the block, and the high half is split into
+   two values that generate each bit position (double hashing). */
+static struct bloom_block *get_block(struct bloom_filter *filter,
+                                     uint64_t hash)
+{
+	return &filter->blocks[hash & filter->block_mask];
+}
+
+static uint32_t get_bit(uint64_t hash, uint32_t i)
+{
+	uint32_t h1 = (hash >> 32) & 0xFFFF;
+	uint32_t h2 = (hash >> 48) | 1;
+	return (h1 + i * h2) % BLOOM_BLOCK_BITS;
+}
+
+void bloom_filter_add(struct bloom_filter *filter, const char *key)
+{
+	uint64_t hash = fnv1a_hash(key);
+	struct bloom_block *block = get_block(filter, hash);
+	for (uint32_t i = 0; i < BLOOM_HASHES; ++i) {
+		uint32_t bit = get_bit(hash, i);
+		_Atomic uint64_t *word = &block->words[bit / 64];
+		uint64_t mask = UINT64_C(1) << (bit % 64);
+		/* Skip the atomic read-modify-write (and the cache line bounce) if
+		   another key already set this bit. */
+		if ((atomic_load_explicit(word, memory_order_relaxed) & mask) == 0) {
+			atomic_fetch_or_explicit(word, mask, memory_order_release);
+		}
+	}
+}
+
+bool bloom_filter_maybe_contains(struct bloom_filter *filter, const char *key)
+{
+	uint64_t hash = fnv1a_hash(key);
+	struct bloom_block *block = get_block(filter, hash);
+	for (uint32_t i = 0; i < BLOOM_HASHES; ++i) {
+		uint32_t bit = get_bit(hash, i);
+		_Atomic uint64_t *word = &block->words[bit / 64];
+		uint64_t mask = UINT64_C(1) << (bit % 64);
+		if ((atomic_load_explicit(word, memory_order_acquire) & mask) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void bloom_filter_destroy(struct bloom_filter *filter)
+{
+	free(filter->blocks);
+	free(filter);
+}
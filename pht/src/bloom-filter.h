@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Forward declaration of a concurrent blocked Bloom filter. It answers
+   "definitely not present" or "maybe present" for a key, so a table can skip
+   its bucket entirely on most misses. Keys can only be added, and adding is
+   safe from any number of threads at once. */
+struct bloom_filter;
+
+/* Create a filter sized for about `expected_entries` keys, with a false
+   positive rate of roughly 1% at that load. */
+struct bloom_filter *bloom_filter_create(size_t expected_entries);
+void bloom_filter_add(struct bloom_filter *filter, const char *key);
+/* Returns false only if `key` was never added. */
+bool bloom_filter_maybe_contains(struct bloom_filter *filter, const char *key);
+void bloom_filter_destroy(struct bloom_filter *filter);
@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "hash-table-shm.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Shared Memory Offset: shm_offset_t
+ * Each process can map the segment at a different address, so nothing inside
+ * it can hold a raw pointer. Instead we store the byte offset from the start
+ * of the segment. Offset 0 is the header, so it also works as our `NULL`.
+ * */
+typedef uint64_t shm_offset_t;
+
+#define HASH_TABLE_SHM_MAGIC UINT64_C(0x7068742d73686d31) /* "pht-shm1" */
+
+/* Linked List Entry: shm_list_entry
+ * Same idea as `list_entry` in the other tables, but the key is copied inline
+ * after the entry since the caller's string isn't visible to other
+ * processes. Entries are only ever prepended to a list and never removed, so
+ * readers can walk a list without any locks.
+ * */
+struct shm_list_entry {
+	_Atomic shm_offset_t next;
+	_Atomic uint32_t value;
+	char key[];
+};
+
+/* Segment Header: shm_header
+ * Lives at offset 0 of the segment. `used` is a bump allocator for entries,
+ * which start right after the header.
+ * */
+struct shm_header {
+	uint64_t magic;
+	uint64_t size;
+	_Atomic uint64_t used;
+	_Atomic shm_offset_t heads[HASH_TABLE_CAPACITY];
+};
+
+/* Hash Table: hash_table_shm
+ * This is the process local handle, it is never placed in the segment.
+ * */
+struct hash_table_shm {
+	struct shm_header *header;
+	size_t size;
+	char *name;
+};
+
+static struct hash_table_shm *map_segment(int fd, size_t size)
+{
+	struct hash_table_shm *hash_table = calloc(1, sizeof(struct hash_table_shm));
+	assert(hash_table != NULL);
+	void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	assert(segment != MAP_FAILED);
+	close(fd);
+	hash_table->header = segment;
+	hash_table->size = size;
+	return hash_table;
+}
+
+/* Create New Hash Table: hash_table_shm_create()
+ * `ftruncate` zero fills the segment, so all the list heads start out as
+ * offset 0 (empty) without touching them.
+ * */
+struct hash_table_shm *hash_table_shm_create(const char *name, size_t size)
+{
+	size += sizeof(struct shm_header);
+	int fd;
+	if (name != NULL) {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	else {
+		fd = memfd_create("pht", MFD_CLOEXEC);
+	}
+	assert(fd >= 0);
+	int err = ftruncate(fd, size);
+	assert(err == 0);
+	(void) err;
+
+	struct hash_table_shm *hash_table = map_segment(fd, size);
+	struct shm_header *header = hash_table->header;
+	header->magic = HASH_TABLE_SHM_MAGIC;
+	header->size = size;
+	atomic_init(&header->used, sizeof(struct shm_header));
+	/* Only the creator owns the name, so only it unlinks it on destroy. */
+	if (name != NULL) {
+		hash_table->name = strdup(name);
+		assert(hash_table->name != NULL);
+	}
+	return hash_table;
+}
+
+struct hash_table_shm *hash_table_shm_open(const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	assert(fd >= 0);
+	struct stat st;
+	int err = fstat(fd, &st);
+	assert(err == 0);
+	(void) err;
+
+	struct hash_table_shm *hash_table = map_segment(fd, st.st_size);
+	assert(hash_table->header->magic == HASH_TABLE_SHM_MAGIC);
+	assert(hash_table->header->size == (size_t) st.st_size);
+	return hash_table;
+}
+
+static struct shm_list_entry *get_entry(struct hash_table_shm *hash_table,
+                                        shm_offset_t offset)
+{
+	return (struct shm_list_entry *) ((char *) hash_table->header + offset);
+}
+
+/* Allocate space for an entry and its key from the segment. There is no way
+   to free space, the segment only grows until the table is destroyed. */
+static shm_offset_t new_entry(struct hash_table_shm *hash_table,
+                              const char *key,
+                              uint32_t value)
+{
+	size_t key_size = strlen(key) + 1;
+	size_t entry_size = sizeof(struct shm_list_entry) + key_size;
+	entry_size = (entry_size + 7) & ~(size_t) 7;
+
+	struct shm_header *header = hash_table->header;
+	shm_offset_t offset = atomic_fetch_add_explicit(&header->used, entry_size,
+	                                                memory_order_relaxed);
+	assert(offset + entry_size <= hash_table->size && "shared hash table is full");
+
+	struct shm_list_entry *list_entry = get_entry(hash_table, offset);
+	atomic_init(&list_entry->value, value);
+	memcpy(list_entry->key, key, key_size);
+	return offset;
+}
+
+static _Atomic shm_offset_t *get_list_head(struct hash_table_shm *hash_table,
+                                           const char *key)
+{
+	assert(key != NULL);
+	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	return &hash_table->header->heads[index];
+}
+
+static struct shm_list_entry *get_list_entry(struct hash_table_shm *hash_table,
+                                             shm_offset_t offset,
+                                             const char *key)
+{
+	while (offset != 0) {
+		struct shm_list_entry *list_entry = get_entry(hash_table, offset);
+		if (strcmp(list_entry->key, key) == 0) {
+			return list_entry;
+		}
+		offset = atomic_load_explicit(&list_entry->next, memory_order_acquire);
+	}
+	return NULL;
+}
+
+bool hash_table_shm_contains(struct hash_table_shm *hash_table,
+                             const char *key)
+{
+	_Atomic shm_offset_t *list_head = get_list_head(hash_table, key);
+	shm_offset_t first = atomic_load_explicit(list_head, memory_order_acquire);
+	return get_list_entry(hash_table, first, key) != NULL;
+}
+
+/* Instead of a lock, we prepend a new entry with a compare and swap on the
+   list head. If another writer got in first we rescan what it added, so a
+   key still ends up in the list exactly once. The entry we allocated is
+   wasted in that case, but that only happens when two writers race on the
+   same new key. */
+void hash_table_shm_add_entry(struct hash_table_shm *hash_table,
+                              const char *key,
+                              uint32_t value)
+{
+	_Atomic shm_offset_t *list_head = get_list_head(hash_table, key);
+	shm_offset_t first = atomic_load_explicit(list_head, memory_order_acquire);
+	shm_offset_t scanned = 0;
+	shm_offset_t offset = 0;
+
+	while (true) {
+		/* Entries after `scanned` were already checked on a previous try. */
+		struct shm_list_entry *list_entry = NULL;
+		for (shm_offset_t i = first; i != scanned; ) {
+			struct shm_list_entry *current = get_entry(hash_table, i);
+			if (strcmp(current->key, key) == 0) {
+				list_entry = current;
+				break;
+			}
+			i = atomic_load_explicit(&current->next, memory_order_acquire);
+		}
+
+		/* Update the value if it already exists */
+		if (list_entry != NULL) {
+			atomic_store_explicit(&list_entry->value, value, memory_order_relaxed);
+			return;
+		}
+
+		if (offset == 0) {
+			offset = new_entry(hash_table, key, value);
+		}
+		struct shm_list_entry *created = get_entry(hash_table, offset);
+		atomic_store_explicit(&created->next, first, memory_order_relaxed);
+		scanned = first;
+		if (atomic_compare_exchange_weak_explicit(list_head, &first, offset,
+		                                          memory_order_release,
+		                                          memory_order_acquire)) {
+			return;
+		}
+	}
+}
+
+uint32_t hash_table_shm_get_value(struct hash_table_shm *hash_table,
+                                  const char *key)
+{
+	_Atomic shm_offset_t *list_head = get_list_head(hash_table, key);
+	shm_offset_t first = atomic_load_explicit(list_head, memory_order_acquire);
+	struct shm_list_entry *list_entry = get_list_entry(hash_table, first, key);
+	assert(list_entry != NULL);
+	return atomic_load_explicit(&list_entry->value, memory_order_relaxed);
+}
+
+void hash_table_shm_destroy(struct hash_table_shm *hash_table)
+{
+	munmap(hash_table->header, hash_table->size);
+	if (hash_table->name != NULL) {
+		shm_unlink(hash_table->name);
+		free(hash_table->name);
+	}
+	free(hash_table);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Forward declaration of our shared memory hash table. The table itself lives
+   in a `shm_open` (or `memfd` if unnamed) segment, so every process that maps
+   it sees the same entries without making its own copy. */
+struct hash_table_shm;
+
+/* Create a new shared hash table backed by a segment called `name` (for
+   example "/pht"), with `size` bytes of storage for keys and entries. If
+   `name` is `NULL` the segment is anonymous and can only be shared with
+   children created by `fork`. */
+struct hash_table_shm *hash_table_shm_create(const char *name, size_t size);
+
+/* Map an existing table created by `hash_table_shm_create` in another
+   process. */
+struct hash_table_shm *hash_table_shm_open(const char *name);
+
+/* Add a new entry, the key is copied into the segment. This is lock-free and
+   safe to call from any thread of any process that has the table mapped. */
+void hash_table_shm_add_entry(struct hash_table_shm *hash_table,
+                              const char *key,
+                              uint32_t value);
+bool hash_table_shm_contains(struct hash_table_shm *hash_table,
+                             const char *key);
+uint32_t hash_table_shm_get_value(struct hash_table_shm *hash_table,
+                                  const char *key);
+
+/* Unmap the table, the creator also removes the segment name. The memory is
+   released once the last process unmaps it. */
+void hash_table_shm_destroy(struct hash_table_shm *hash_table);
@@ -1,4 +1,5 @@
 #include "hash-table-base.h"
+#include "lock-profile.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -24,6 +25,9 @@ struct hash_table_v1 {
 	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
 	pthread_mutex_t * mutex_ptr;
 	pthread_mutex_t mutex;
+#ifdef PHT_LOCK_PROFILE
+	struct lock_profile profile;
+#endif
 };
 
 struct hash_table_v1 * hash_table_v1_create()
@@ -41,6 +45,24 @@ struct hash_table_v1 * hash_table_v1_create()
 	return hash_table;
 }
 
+static void lock(struct hash_table_v1 *hash_table)
+{
+#ifdef PHT_LOCK_PROFILE
+	lock_profile_lock(hash_table->mutex_ptr, &hash_table->profile);
+#else
+	pthread_mutex_lock(hash_table->mutex_ptr);
+#endif
+}
+
+static void unlock(struct hash_table_v1 *hash_table)
+{
+#ifdef PHT_LOCK_PROFILE
+	lock_profile_unlock(hash_table->mutex_ptr, &hash_table->profile);
+#else
+	pthread_mutex_unlock(hash_table->mutex_ptr);
+#endif
+}
+
 static struct hash_table_entry * get_hash_table_entry(struct hash_table_v1 *hash_table,
                                                      const char *key)
 {
@@ -78,7 +100,7 @@ void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
                              const char *key,
                              uint32_t value)
  {
-    pthread_mutex_lock(hash_table->mutex_ptr);
+    lock(hash_table);
 
     struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
@@ -87,6 +109,7 @@ void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
 		list_entry->value = value;
+		unlock(hash_table);
 		return;
 	}
 
@@ -95,7 +118,7 @@ void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
 	list_entry->value = value;
 	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
 
-	pthread_mutex_unlock(hash_table->mutex_ptr);
+	unlock(hash_table);
 }
 
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
@@ -121,6 +144,9 @@ void hash_table_v1_destroy(struct hash_table_v1 *hash_table)
 		}
 	}
 
+#ifdef PHT_LOCK_PROFILE
+	lock_profile_report("Hash table v1", &hash_table->profile, 1);
+#endif
 	pthread_mutex_destroy(hash_table->mutex_ptr);
 
 	free(hash_table);
@@ -1,4 +1,6 @@
 #include "hash-table-base.h"
+#include "bloom-filter.h"
+#include "lock-profile.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -22,6 +24,10 @@ struct hash_table_entry {
 
 struct hash_table_v2 {
 	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+	struct bloom_filter *filter; // optional, NULL if created without one
+#ifdef PHT_LOCK_PROFILE
+	struct lock_profile profiles[HASH_TABLE_CAPACITY]; // one per bucket lock
+#endif
 };
 
 struct hash_table_v2 *hash_table_v2_create()
@@ -38,14 +44,33 @@ struct hash_table_v2 *hash_table_v2_create()
 	return hash_table;
 }
 
-void set_start(struct hash_table_entry *entry)
+struct hash_table_v2 *hash_table_v2_create_with_filter(size_t expected_entries)
 {
+	struct hash_table_v2 *hash_table = hash_table_v2_create();
+	hash_table->filter = bloom_filter_create(expected_entries);
+	return hash_table;
+}
+
+void set_start(struct hash_table_v2 *hash_table, struct hash_table_entry *entry)
+{
+#ifdef PHT_LOCK_PROFILE
+    size_t index = entry - hash_table->entries;
+    lock_profile_lock(entry->write_mtx_ptr, &hash_table->profiles[index]);
+#else
+    (void) hash_table;
     pthread_mutex_lock(entry->write_mtx_ptr);
+#endif
 }
 
-void set_end(struct hash_table_entry *entry)
+void set_end(struct hash_table_v2 *hash_table, struct hash_table_entry *entry)
 {
+#ifdef PHT_LOCK_PROFILE
+    size_t index = entry - hash_table->entries;
+    lock_profile_unlock(entry->write_mtx_ptr, &hash_table->profiles[index]);
+#else
+    (void) hash_table;
     pthread_mutex_unlock(entry->write_mtx_ptr);
+#endif
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_v2 *hash_table,
@@ -75,6 +100,10 @@ static struct list_entry *get_list_entry(struct list_head *list_head,
 bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key)
 {
+	if (hash_table->filter != NULL
+	    && !bloom_filter_maybe_contains(hash_table->filter, key)) {
+		return false;
+	}
 	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
 	struct list_entry *list_entry = get_list_entry(list_head, key);
@@ -87,7 +116,13 @@ void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
 {
     struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 
-    set_start(hash_table_entry);
+    /* Set the filter bits before the entry is visible in the bucket, so a
+       reader that can find the entry never gets a negative from the filter. */
+    if (hash_table->filter != NULL) {
+        bloom_filter_add(hash_table->filter, key);
+    }
+
+    set_start(hash_table, hash_table_entry);
 
     struct list_head *list_head = &hash_table_entry->list_head;
     struct list_entry *list_entry = get_list_entry(list_head, key);
@@ -95,6 +130,7 @@ void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
 		list_entry->value = value;
+		set_end(hash_table, hash_table_entry);
 		return;
 	}
 
@@ -104,7 +140,7 @@ void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
 
 	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
 
-	set_end(hash_table_entry);
+	set_end(hash_table, hash_table_entry);
 }
 
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
@@ -117,12 +153,122 @@ uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
 	return list_entry->value;
 }
 
+/* Staged Entry: bulk_entry
+ * An insert waiting to be merged. We keep the bucket index so the merge
+ * doesn't need to hash the key again.
+ * */
+struct bulk_entry {
+	const char *key;
+	uint32_t value;
+	uint32_t index;
+};
+
+struct bulk_buffer {
+	struct bulk_entry *entries;
+	size_t count;
+	size_t capacity;
+};
+
+/* Bulk Loader: hash_table_v2_bulk
+ * `buffers` is a `threads` x `threads` matrix, row `t` belongs to producer
+ * `t` and column `p` holds everything it staged for partition `p`. Partition
+ * `p` is the bucket range [`p` * `CAPACITY` / `threads`,
+ * (`p` + 1) * `CAPACITY` / `threads`).
+ * */
+struct hash_table_v2_bulk {
+	struct hash_table_v2 *hash_table;
+	uint32_t threads;
+	struct bulk_buffer *buffers;
+};
+
+struct hash_table_v2_bulk *hash_table_v2_bulk_create(struct hash_table_v2 *hash_table,
+                                                     uint32_t threads)
+{
+	assert(threads > 0 && threads <= HASH_TABLE_CAPACITY);
+	struct hash_table_v2_bulk *bulk = calloc(1, sizeof(struct hash_table_v2_bulk));
+	assert(bulk != NULL);
+	bulk->hash_table = hash_table;
+	bulk->threads = threads;
+	bulk->buffers = calloc((size_t) threads * threads, sizeof(struct bulk_buffer));
+	assert(bulk->buffers != NULL);
+	return bulk;
+}
+
+void hash_table_v2_bulk_stage(struct hash_table_v2_bulk *bulk,
+                              uint32_t thread,
+                              const char *key,
+                              uint32_t value)
+{
+	assert(key != NULL);
+	assert(thread < bulk->threads);
+	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	uint32_t partition = ((uint64_t) index * bulk->threads) / HASH_TABLE_CAPACITY;
+	struct bulk_buffer *buffer = &bulk->buffers[thread * bulk->threads + partition];
+
+	if (buffer->count == buffer->capacity) {
+		buffer->capacity = buffer->capacity == 0 ? 64 : buffer->capacity * 2;
+		buffer->entries = realloc(buffer->entries,
+		                          buffer->capacity * sizeof(struct bulk_entry));
+		assert(buffer->entries != NULL);
+	}
+	struct bulk_entry *entry = &buffer->entries[buffer->count++];
+	entry->key = key;
+	entry->value = value;
+	entry->index = index;
+}
+
+/* Same as `hash_table_v2_add_entry`, minus the lock. Producers are merged
+   in order, so if two of them staged the same key the higher thread wins. */
+void hash_table_v2_bulk_merge(struct hash_table_v2_bulk *bulk,
+                              uint32_t partition)
+{
+	assert(partition < bulk->threads);
+	struct hash_table_v2 *hash_table = bulk->hash_table;
+	for (uint32_t thread = 0; thread < bulk->threads; ++thread) {
+		struct bulk_buffer *buffer = &bulk->buffers[thread * bulk->threads + partition];
+		for (size_t i = 0; i < buffer->count; ++i) {
+			struct bulk_entry *entry = &buffer->entries[i];
+			if (hash_table->filter != NULL) {
+				bloom_filter_add(hash_table->filter, entry->key);
+			}
+
+			struct list_head *list_head = &hash_table->entries[entry->index].list_head;
+			struct list_entry *list_entry = get_list_entry(list_head, entry->key);
+			if (list_entry != NULL) {
+				list_entry->value = entry->value;
+				continue;
+			}
+
+			list_entry = calloc(1, sizeof(struct list_entry));
+			list_entry->key = entry->key;
+			list_entry->value = entry->value;
+			SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+		}
+		free(buffer->entries);
+		buffer->entries = NULL;
+		buffer->count = 0;
+		buffer->capacity = 0;
+	}
+}
+
+void hash_table_v2_bulk_destroy(struct hash_table_v2_bulk *bulk)
+{
+	for (size_t i = 0; i < (size_t) bulk->threads * bulk->threads; ++i) {
+		free(bulk->buffers[i].entries);
+	}
+	free(bulk->buffers);
+	free(bulk);
+}
+
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table)
 {
+#ifdef PHT_LOCK_PROFILE
+	lock_profile_report("Hash table v2", hash_table->profiles, HASH_TABLE_CAPACITY);
+#endif
 	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
 		struct hash_table_entry *entry = &hash_table->entries[i];
 
-		free(entry->write_mtx_ptr);
+		pthread_mutex_destroy(entry->write_mtx_ptr);
 
 		struct list_head *list_head = &entry->list_head;
 		struct list_entry *list_entry = NULL;
@@ -132,5 +278,8 @@ void hash_table_v2_destroy(struct hash_table_v2 *hash_table)
 			free(list_entry);
 		}
 	}
+	if (hash_table->filter != NULL) {
+		bloom_filter_destroy(hash_table->filter);
+	}
 	free(hash_table);
 }
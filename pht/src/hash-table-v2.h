@@ -3,9 +3,13 @@
 #include "hash-table-common.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct hash_table_v2;
 struct hash_table_v2 *hash_table_v2_create();
+/* Same as `hash_table_v2_create`, but lookups first check a Bloom filter
+   sized for `expected_entries` keys, so most misses never touch a bucket. */
+struct hash_table_v2 *hash_table_v2_create_with_filter(size_t expected_entries);
 void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
                              const char *key,
                              uint32_t value);
@@ -14,3 +18,21 @@ bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char* key);
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table);
+
+/* Bulk loading: each of `threads` producers stages its inserts with
+   `hash_table_v2_bulk_stage` into private buffers, one per bucket range.
+   Once every producer is done staging (the caller has to wait for that,
+   e.g. with a barrier), each thread merges one bucket range with
+   `hash_table_v2_bulk_merge`. Only one thread ever touches a range, so
+   neither step takes a lock. Nothing is visible in the table until its
+   range is merged. */
+struct hash_table_v2_bulk;
+struct hash_table_v2_bulk *hash_table_v2_bulk_create(struct hash_table_v2 *hash_table,
+                                                     uint32_t threads);
+void hash_table_v2_bulk_stage(struct hash_table_v2_bulk *bulk,
+                              uint32_t thread,
+                              const char *key,
+                              uint32_t value);
+void hash_table_v2_bulk_merge(struct hash_table_v2_bulk *bulk,
+                              uint32_t partition);
+void hash_table_v2_bulk_destroy(struct hash_table_v2_bulk *bulk);
@@ -0,0 +1,108 @@
+#include "lock-profile.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Try the lock first, so the uncontended case only costs an extra clock
+   read for the hold time. */
+void lock_profile_lock(pthread_mutex_t *mutex, struct lock_profile *profile)
+{
+	if (pthread_mutex_trylock(mutex) == 0) {
+		profile->hold_start_ns = now_ns();
+		++profile->acquisitions;
+		return;
+	}
+
+	uint64_t start = now_ns();
+	pthread_mutex_lock(mutex);
+	uint64_t end = now_ns();
+	profile->hold_start_ns = end;
+	++profile->acquisitions;
+	++profile->contended;
+	profile->wait_ns += end - start;
+}
+
+void lock_profile_unlock(pthread_mutex_t *mutex, struct lock_profile *profile)
+{
+	uint64_t hold = now_ns() - profile->hold_start_ns;
+	if (hold > profile->max_hold_ns) {
+		profile->max_hold_ns = hold;
+	}
+	pthread_mutex_unlock(mutex);
+}
+
+static const struct lock_profile *sort_profiles;
+
+/* Hottest first: longest total wait, then most contended acquisitions, then
+   most acquisitions overall. */
+static int compare_heat(const void *a, const void *b)
+{
+	const struct lock_profile *x = &sort_profiles[*(const size_t *) a];
+	const struct lock_profile *y = &sort_profiles[*(const size_t *) b];
+	if (x->wait_ns != y->wait_ns) {
+		return x->wait_ns < y->wait_ns ? 1 : -1;
+	}
+	if (x->contended != y->contended) {
+		return x->contended < y->contended ? 1 : -1;
+	}
+	if (x->acquisitions != y->acquisitions) {
+		return x->acquisitions < y->acquisitions ? 1 : -1;
+	}
+	return 0;
+}
+
+void lock_profile_report(const char *name,
+                         const struct lock_profile *profiles,
+                         size_t count)
+{
+	size_t *order = calloc(count, sizeof(size_t));
+	assert(order != NULL);
+	uint64_t acquisitions = 0;
+	uint64_t contended = 0;
+	uint64_t wait_ns = 0;
+	for (size_t i = 0; i < count; ++i) {
+		order[i] = i;
+		acquisitions += profiles[i].acquisitions;
+		contended += profiles[i].contended;
+		wait_ns += profiles[i].wait_ns;
+	}
+	/* Reports happen once per table, on destroy, so a global is fine. */
+	sort_profiles = profiles;
+	qsort(order, count, sizeof(size_t), compare_heat);
+
+	/* A single lock guards the whole table, there are no buckets to break
+	   it down into. */
+	if (count == 1) {
+		fprintf(stderr, "%s global lock: %" PRIu64 " acquisitions, %" PRIu64
+		        " contended, %" PRIu64 " usec waiting, %" PRIu64 " usec max hold\n",
+		        name, acquisitions, contended, wait_ns / 1000,
+		        profiles[0].max_hold_ns / 1000);
+		free(order);
+		return;
+	}
+	fprintf(stderr, "%s locks: %" PRIu64 " acquisitions, %" PRIu64 " contended, "
+	        "%" PRIu64 " usec waiting\n",
+	        name, acquisitions, contended, wait_ns / 1000);
+	size_t top = count < PHT_LOCK_PROFILE ? count : PHT_LOCK_PROFILE;
+	for (size_t i = 0; i < top; ++i) {
+		const struct lock_profile *profile = &profiles[order[i]];
+		if (profile->acquisitions == 0) {
+			break;
+		}
+		fprintf(stderr, "  - bucket %zu: %" PRIu64 " acquisitions, %" PRIu64
+		        " contended, %" PRIu64 " usec waiting, %" PRIu64 " usec max hold\n",
+		        order[i], profile->acquisitions, profile->contended,
+		        profile->wait_ns / 1000, profile->max_hold_ns / 1000);
+	}
+	free(order);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opt-in lock contention profiling. Configure with `-Dlock_profile=N` and
+   every table lock records how often it's taken, how often a thread had to
+   wait for it, for how long, and the longest time it was held. When the
+   table is destroyed the N locks threads waited on the longest are printed
+   to stderr. With profiling off (the default) the tables call
+   `pthread_mutex_lock` directly and none of this is compiled in. */
+#ifdef PHT_LOCK_PROFILE
+
+/* All fields are only written while holding the lock they describe, so they
+   don't need to be atomic. */
+struct lock_profile {
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t wait_ns;
+	uint64_t max_hold_ns;
+	uint64_t hold_start_ns;
+};
+
+void lock_profile_lock(pthread_mutex_t *mutex, struct lock_profile *profile);
+void lock_profile_unlock(pthread_mutex_t *mutex, struct lock_profile *profile);
+/* Print the top `PHT_LOCK_PROFILE` of `count` locks. `name` is the table,
+   and the index of each lock in `profiles` is reported as its bucket. A
+   table with a single lock gets one line for its global lock instead. */
+void lock_profile_report(const char *name,
+                         const struct lock_profile *profiles,
+                         size_t count);
+
+#endif
@@ -1,13 +1,18 @@
 #include "hash-table-base.h"
 #include "hash-table-v1.h"
 #include "hash-table-v2.h"
+#include "hash-table-shm.h"
+#include "skip-list.h"
 
 #include <argp.h>
 #include <locale.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 char *entries;
 
@@ -122,6 +127,80 @@ void *run_v2(void *arg) {
 	return NULL;
 }
 
+static struct hash_table_v2_bulk *hash_table_v2_bulk;
+static pthread_barrier_t bulk_barrier;
+
+void *run_v2_bulk(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_v2_bulk_stage(hash_table_v2_bulk, thread, string, global_index);
+	}
+	pthread_barrier_wait(&bulk_barrier);
+	hash_table_v2_bulk_merge(hash_table_v2_bulk, thread);
+	return NULL;
+}
+
+static struct hash_table_shm *hash_table_shm;
+
+void *run_shm(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_shm_add_entry(hash_table_shm, string, global_index);
+	}
+	return NULL;
+}
+
+/* Each reader process maps the table by name and looks up every key, the
+   exit status is whether it found them all. */
+static int read_shm(const char *name) {
+	struct hash_table_shm *hash_table = hash_table_shm_open(name);
+	size_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_shm_contains(hash_table, string)) {
+				++missing;
+			}
+		}
+	}
+	hash_table_shm_destroy(hash_table);
+	return missing == 0 ? 0 : 1;
+}
+
+static struct skip_list *skip_list;
+
+void *run_skip_list(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		skip_list_add_entry(skip_list, string, global_index);
+	}
+	return NULL;
+}
+
+/* Checks a full range scan comes back in strictly ascending order. */
+struct scan_state {
+	const char *previous;
+	size_t count;
+	size_t out_of_order;
+};
+
+static void check_scan(const char *key, uint32_t value, void *arg) {
+	(void) value;
+	struct scan_state *state = arg;
+	if (state->previous != NULL && strcmp(state->previous, key) >= 0) {
+		++state->out_of_order;
+	}
+	state->previous = key;
+	++state->count;
+}
+
 int main(int argc, char *argv[]) {
 	arguments.threads = 4;
 	arguments.size = 25000;
@@ -256,6 +335,185 @@ int main(int argc, char *argv[]) {
 	    hash_table_v2_destroy(hash_table_v2);
 	}
 
+	{
+	    hash_table_v2 = hash_table_v2_create();
+	    hash_table_v2_bulk = hash_table_v2_bulk_create(hash_table_v2, arguments.threads);
+	    pthread_barrier_init(&bulk_barrier, NULL, arguments.threads);
+	    gettimeofday(&start, NULL);
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_create(&threads[i], NULL, run_v2_bulk, (void*) i);
+	        if (err != 0) {
+	            printf("pthread_create returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_join(threads[i], NULL);
+	        if (err != 0) {
+	            printf("pthread_join returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("Hash table v2 bulk load: %'lu usec\n", usec_diff(&start, &end));
+	    pthread_barrier_destroy(&bulk_barrier);
+	    hash_table_v2_bulk_destroy(hash_table_v2_bulk);
+
+	    size_t missing = 0;
+	    for (uint32_t i = 0; i < arguments.threads; ++i) {
+	        for (uint32_t j = 0; j < arguments.size; ++j) {
+	            size_t global_index = get_global_index(i, j);
+	            char *string = get_string(global_index);
+	            if (!hash_table_v2_contains(hash_table_v2, string)) {
+	                ++missing;
+	            }
+	        }
+	    }
+	    printf("  - %'lu missing\n", missing);
+	    hash_table_v2_destroy(hash_table_v2);
+	}
+
+	{
+	    char name[32];
+	    snprintf(name, sizeof(name), "/pht-tester-%d", (int) getpid());
+	    size_t entries = (size_t) arguments.threads * arguments.size;
+	    hash_table_shm = hash_table_shm_create(name, entries * 32);
+	    gettimeofday(&start, NULL);
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_create(&threads[i], NULL, run_shm, (void*) i);
+	        if (err != 0) {
+	            printf("pthread_create returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_join(threads[i], NULL);
+	        if (err != 0) {
+	            printf("pthread_join returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("Hash table shm: %'lu usec\n", usec_diff(&start, &end));
+
+	    fflush(stdout);
+	    gettimeofday(&start, NULL);
+	    for (uint32_t i = 0; i < arguments.threads; ++i) {
+	        pid_t pid = fork();
+	        if (pid == 0) {
+	            exit(read_shm(name));
+	        }
+	        else if (pid == -1) {
+	            perror("fork");
+	            return 1;
+	        }
+	    }
+	    size_t failed = 0;
+	    for (uint32_t i = 0; i < arguments.threads; ++i) {
+	        int wstatus;
+	        wait(&wstatus);
+	        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+	            ++failed;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("  - %'u reader processes: %'lu usec\n", arguments.threads,
+	           usec_diff(&start, &end));
+	    printf("  - %'lu readers missing entries\n", failed);
+	    hash_table_shm_destroy(hash_table_shm);
+	}
+
+	{
+	    /* Miss-heavy lookups: the generated keys are all letters, so putting a
+	       digit in front of each one gives a key that is never in the table. */
+	    size_t entries = (size_t) arguments.threads * arguments.size;
+	    char *misses = calloc(entries, BYTES_PER_STRING);
+	    for (size_t i = 0; i < entries; ++i) {
+	        char *miss = misses + (i * BYTES_PER_STRING);
+	        memcpy(miss, get_string(i), BYTES_PER_STRING);
+	        miss[0] = 0x30 + (i % 10);
+	    }
+
+	    struct hash_table_v2 *tables[2] = {
+	        hash_table_v2_create(),
+	        hash_table_v2_create_with_filter(entries),
+	    };
+	    const char *names[2] = { "v2", "v2 + bloom filter" };
+	    for (size_t t = 0; t < 2; ++t) {
+	        for (size_t i = 0; i < entries; ++i) {
+	            hash_table_v2_add_entry(tables[t], get_string(i), i);
+	        }
+	        size_t found = 0;
+	        gettimeofday(&start, NULL);
+	        for (size_t i = 0; i < entries; ++i) {
+	            if (hash_table_v2_contains(tables[t], misses + (i * BYTES_PER_STRING))) {
+	                ++found;
+	            }
+	        }
+	        gettimeofday(&end, NULL);
+	        printf("Hash table %s misses: %'lu usec\n", names[t], usec_diff(&start, &end));
+	        printf("  - %'lu found\n", found);
+	        hash_table_v2_destroy(tables[t]);
+	    }
+	    free(misses);
+	}
+
+	{
+	    skip_list = skip_list_create();
+	    gettimeofday(&start, NULL);
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_create(&threads[i], NULL, run_skip_list, (void*) i);
+	        if (err != 0) {
+	            printf("pthread_create returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    for (uintptr_t i = 0; i < arguments.threads; ++i) {
+	        int err = pthread_join(threads[i], NULL);
+	        if (err != 0) {
+	            printf("pthread_join returned %d\n", err);
+	            return err;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("Skip list: %'lu usec\n", usec_diff(&start, &end));
+
+	    struct scan_state state = { 0 };
+	    skip_list_range_scan(skip_list, NULL, NULL, check_scan, &state);
+	    printf("  - %'lu scanned, %'lu out of order\n", state.count,
+	           state.out_of_order);
+
+	    /* Point lookups of every key, against v2 holding the same keys. */
+	    struct hash_table_v2 *hash_table = hash_table_v2_create();
+	    size_t entries = (size_t) arguments.threads * arguments.size;
+	    for (size_t i = 0; i < entries; ++i) {
+	        hash_table_v2_add_entry(hash_table, get_string(i), i);
+	    }
+	    size_t missing = 0;
+	    gettimeofday(&start, NULL);
+	    for (size_t i = 0; i < entries; ++i) {
+	        if (!hash_table_v2_contains(hash_table, get_string(i))) {
+	            ++missing;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("Hash table v2 lookups: %'lu usec\n", usec_diff(&start, &end));
+	    printf("  - %'lu missing\n", missing);
+	    hash_table_v2_destroy(hash_table);
+
+	    missing = 0;
+	    gettimeofday(&start, NULL);
+	    for (size_t i = 0; i < entries; ++i) {
+	        if (!skip_list_contains(skip_list, get_string(i))) {
+	            ++missing;
+	        }
+	    }
+	    gettimeofday(&end, NULL);
+	    printf("Skip list lookups: %'lu usec\n", usec_diff(&start, &end));
+	    printf("  - %'lu missing\n", missing);
+	    skip_list_destroy(skip_list);
+	}
+
 	free(threads);
 	free(data);
 
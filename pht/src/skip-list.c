@@ -0,0 +1,221 @@
+#include "skip-list.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* With a 1/2 chance of going up a level, 24 levels is plenty for the 2^24
+   entries you'd ever want to put in this. */
+#define SKIP_LIST_MAX_LEVEL 24
+
+/* Skip List Node: skip_list_node
+ * Like `list_entry` in the hash tables, the key is the caller's string. A
+ * node of height `h` is linked into the lowest `h` lists. Nodes are never
+ * removed, which is what lets us insert with nothing but compare and swaps:
+ * once a node is reachable it stays reachable.
+ * */
+struct skip_list_node {
+	const char *key;
+	_Atomic uint32_t value;
+	int height;
+	_Atomic(struct skip_list_node *) next[];
+};
+
+struct skip_list {
+	struct skip_list_node *head;
+};
+
+static struct skip_list_node *new_node(const char *key,
+                                       uint32_t value,
+                                       int height)
+{
+	struct skip_list_node *node = calloc(1, sizeof(struct skip_list_node)
+	                                     + height * sizeof(node->next[0]));
+	assert(node != NULL);
+	node->key = key;
+	atomic_init(&node->value, value);
+	node->height = height;
+	for (int i = 0; i < height; ++i) {
+		atomic_init(&node->next[i], NULL);
+	}
+	return node;
+}
+
+struct skip_list *skip_list_create()
+{
+	struct skip_list *skip_list = calloc(1, sizeof(struct skip_list));
+	assert(skip_list != NULL);
+	skip_list->head = new_node(NULL, 0, SKIP_LIST_MAX_LEVEL);
+	return skip_list;
+}
+
+/* Instead of a random number generator (which would need per thread state),
+   the height comes from a well mixed hash of the key, which is just as
+   geometrically distributed. */
+static int get_height(const char *key)
+{
+	uint32_t hash = bernstein_hash(key);
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	int height = 1;
+	while ((hash & 1) && height < SKIP_LIST_MAX_LEVEL) {
+		hash >>= 1;
+		++height;
+	}
+	return height;
+}
+
+static struct skip_list_node *get_next(struct skip_list_node *node, int level)
+{
+	return atomic_load_explicit(&node->next[level], memory_order_acquire);
+}
+
+/* Find the last node before `key` and the first node at or after it on
+   every level. Returns the node with exactly this key, if there is one. */
+static struct skip_list_node *find(struct skip_list *skip_list,
+                                   const char *key,
+                                   struct skip_list_node **preds,
+                                   struct skip_list_node **succs)
+{
+	struct skip_list_node *pred = skip_list->head;
+	for (int level = SKIP_LIST_MAX_LEVEL - 1; level >= 0; --level) {
+		struct skip_list_node *curr = get_next(pred, level);
+		while (curr != NULL && strcmp(curr->key, key) < 0) {
+			pred = curr;
+			curr = get_next(pred, level);
+		}
+		if (preds != NULL) {
+			preds[level] = pred;
+			succs[level] = curr;
+		}
+	}
+	struct skip_list_node *curr = get_next(pred, 0);
+	if (curr != NULL && strcmp(curr->key, key) == 0) {
+		return curr;
+	}
+	return NULL;
+}
+
+/* The node becomes part of the map once it's linked at level 0, the upper
+   levels are only shortcuts. If a compare and swap fails, another thread
+   inserted next to us, so we search again and retry. If the other thread
+   inserted our key, we update its value instead. */
+void skip_list_add_entry(struct skip_list *skip_list,
+                         const char *key,
+                         uint32_t value)
+{
+	assert(key != NULL);
+	struct skip_list_node *preds[SKIP_LIST_MAX_LEVEL];
+	struct skip_list_node *succs[SKIP_LIST_MAX_LEVEL];
+	struct skip_list_node *node = NULL;
+
+	while (true) {
+		struct skip_list_node *found = find(skip_list, key, preds, succs);
+		/* Update the value if it already exists */
+		if (found != NULL) {
+			atomic_store_explicit(&found->value, value, memory_order_relaxed);
+			free(node);
+			return;
+		}
+		if (node == NULL) {
+			node = new_node(key, value, get_height(key));
+		}
+		atomic_store_explicit(&node->next[0], succs[0], memory_order_relaxed);
+		if (atomic_compare_exchange_strong_explicit(&preds[0]->next[0],
+		                                            &succs[0], node,
+		                                            memory_order_release,
+		                                            memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	for (int level = 1; level < node->height; ++level) {
+		while (true) {
+			struct skip_list_node *succ = succs[level];
+			atomic_store_explicit(&node->next[level], succ, memory_order_relaxed);
+			if (atomic_compare_exchange_strong_explicit(&preds[level]->next[level],
+			                                            &succ, node,
+			                                            memory_order_release,
+			                                            memory_order_relaxed)) {
+				break;
+			}
+			find(skip_list, key, preds, succs);
+		}
+	}
+}
+
+bool skip_list_contains(struct skip_list *skip_list,
+                        const char *key)
+{
+	assert(key != NULL);
+	return find(skip_list, key, NULL, NULL) != NULL;
+}
+
+uint32_t skip_list_get_value(struct skip_list *skip_list,
+                             const char *key)
+{
+	assert(key != NULL);
+	struct skip_list_node *node = find(skip_list, key, NULL, NULL);
+	assert(node != NULL);
+	return atomic_load_explicit(&node->value, memory_order_relaxed);
+}
+
+/* Returns the first node with a key at or after `key`. */
+static struct skip_list_node *lower_bound(struct skip_list *skip_list,
+                                          const char *key)
+{
+	if (key == NULL) {
+		return get_next(skip_list->head, 0);
+	}
+	struct skip_list_node *preds[SKIP_LIST_MAX_LEVEL];
+	struct skip_list_node *succs[SKIP_LIST_MAX_LEVEL];
+	find(skip_list, key, preds, succs);
+	return succs[0];
+}
+
+void skip_list_range_scan(struct skip_list *skip_list,
+                          const char *lo,
+                          const char *hi,
+                          skip_list_callback callback,
+                          void *arg)
+{
+	struct skip_list_node *node = lower_bound(skip_list, lo);
+	while (node != NULL && (hi == NULL || strcmp(node->key, hi) < 0)) {
+		callback(node->key,
+		         atomic_load_explicit(&node->value, memory_order_relaxed),
+		         arg);
+		node = get_next(node, 0);
+	}
+}
+
+void skip_list_prefix_scan(struct skip_list *skip_list,
+                           const char *prefix,
+                           skip_list_callback callback,
+                           void *arg)
+{
+	assert(prefix != NULL);
+	size_t length = strlen(prefix);
+	struct skip_list_node *node = lower_bound(skip_list, prefix);
+	while (node != NULL && strncmp(node->key, prefix, length) == 0) {
+		callback(node->key,
+		         atomic_load_explicit(&node->value, memory_order_relaxed),
+		         arg);
+		node = get_next(node, 0);
+	}
+}
+
+/* Every node is on the level 0 list, so freeing that list frees them all. */
+void skip_list_destroy(struct skip_list *skip_list)
+{
+	struct skip_list_node *node = skip_list->head;
+	while (node != NULL) {
+		struct skip_list_node *next = get_next(node, 0);
+		free(node);
+		node = next;
+	}
+	free(skip_list);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* Forward declaration of our ordered map, a lock-free skip list. It has the
+   same interface as the hash tables, but keeps the keys sorted (by `strcmp`)
+   so it can also answer range and prefix queries. */
+struct skip_list;
+
+/* Called for every (key, value) visited by a scan, in ascending key order. */
+typedef void (*skip_list_callback)(const char *key, uint32_t value, void *arg);
+
+struct skip_list *skip_list_create();
+/* Safe to call from any number of threads at once, without locks. */
+void skip_list_add_entry(struct skip_list *skip_list,
+                         const char *key,
+                         uint32_t value);
+bool skip_list_contains(struct skip_list *skip_list,
+                        const char *key);
+uint32_t skip_list_get_value(struct skip_list *skip_list,
+                             const char *key);
+/* Visit every key where `lo <= key < hi`. A `NULL` bound is unbounded. */
+void skip_list_range_scan(struct skip_list *skip_list,
+                          const char *lo,
+                          const char *hi,
+                          skip_list_callback callback,
+                          void *arg);
+/* Visit every key that starts with `prefix`. */
+void skip_list_prefix_scan(struct skip_list *skip_list,
+                           const char *prefix,
+                           skip_list_callback callback,
+                           void *arg);
+void skip_list_destroy(struct skip_list *skip_list);
@@ -0,0 +1,182 @@
+#include "wut.h"
+
+#include <arpa/inet.h> // htonl
+#include <errno.h> // errno
+#include <netinet/in.h> // sockaddr_in
+#include <poll.h> // POLLOUT
+#include <pthread.h> // pthread_create
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <sys/socket.h> // socketpair, socket
+#include <time.h> // clock_gettime
+#include <unistd.h> // close
+
+/* Echo server: every connection gets an echo thread, and a client thread
+ * per connection sends small messages and waits for each reply. This runs
+ * over socketpairs and over TCP loopback (where connections come in
+ * through wut_accept), and for reference with one blocking pthread per
+ * socketpair connection.
+ */
+
+#define DEFAULT_CONNECTIONS 64
+#define MAX_CONNECTIONS 1024
+#define DEFAULT_ROUNDS 2000
+#define MESSAGE_SIZE 64
+
+static int connections;
+static int rounds;
+static int server_fds[MAX_CONNECTIONS];
+static int client_fds[MAX_CONNECTIONS];
+static int next_server, next_client;
+static int listen_fd;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void echo(void) {
+    int fd = server_fds[next_server++];
+    char buf[MESSAGE_SIZE];
+    ssize_t n;
+    while ((n = wut_read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t written = wut_write(fd, buf + done, n - done);
+            if (written <= 0) return;
+            done += written;
+        }
+    }
+    close(fd);
+}
+
+static void client(void) {
+    int fd = client_fds[next_client++];
+    char buf[MESSAGE_SIZE] = { 0 };
+    for (int i = 0; i < rounds; ++i) {
+        wut_write(fd, buf, sizeof(buf));
+        for (ssize_t got = 0; got < MESSAGE_SIZE; ) {
+            ssize_t n = wut_read(fd, buf + got, sizeof(buf) - got);
+            if (n <= 0) return;
+            got += n;
+        }
+    }
+    close(fd);
+}
+
+static void acceptor(void) {
+    for (int i = 0; i < connections; ++i) {
+        server_fds[i] = wut_accept(listen_fd, NULL, NULL);
+        wut_create(echo);
+    }
+}
+
+static void connector(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr*) &addr, &len);
+    for (int i = 0; i < connections; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (connect(fd, (struct sockaddr*) &addr, len) == -1 && errno == EINPROGRESS) {
+            wut_poll(fd, POLLOUT);
+        }
+        client_fds[i] = fd;
+    }
+}
+
+static void report(const char* name, long long start, long long end) {
+    double round_trips = (double) connections * rounds;
+    printf("%s: %.0f round trips/s, %.1f us per round trip\n", name,
+           round_trips * 1e9 / (end - start), (end - start) / round_trips / 1e3);
+}
+
+static void run_clients(const char* name) {
+    int ids[MAX_CONNECTIONS];
+    next_client = 0;
+    long long start = now_ns();
+    for (int i = 0; i < connections; ++i) {
+        ids[i] = wut_create(client);
+    }
+    for (int i = 0; i < connections; ++i) {
+        wut_join(ids[i]);
+    }
+    report(name, start, now_ns());
+}
+
+static void* blocking_echo(void* arg) {
+    int fd = *(int*) arg;
+    char buf[MESSAGE_SIZE];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        write(fd, buf, n);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void* blocking_client(void* arg) {
+    int fd = *(int*) arg;
+    char buf[MESSAGE_SIZE] = { 0 };
+    for (int i = 0; i < rounds; ++i) {
+        write(fd, buf, sizeof(buf));
+        for (ssize_t got = 0; got < MESSAGE_SIZE; ) {
+            ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+            if (n <= 0) return NULL;
+            got += n;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    connections = argc > 1 ? atoi(argv[1]) : DEFAULT_CONNECTIONS;
+    if (connections < 1 || connections > MAX_CONNECTIONS) connections = DEFAULT_CONNECTIONS;
+    rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+
+    wut_init();
+
+    // socketpair
+    next_server = 0;
+    for (int i = 0; i < connections; ++i) {
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+        server_fds[i] = sv[0];
+        client_fds[i] = sv[1];
+        wut_create(echo);
+    }
+    run_clients("wut socketpair");
+
+    // TCP loopback
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0 };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    listen(listen_fd, MAX_CONNECTIONS);
+    next_server = 0;
+    int acceptor_id = wut_create(acceptor);
+    wut_join(wut_create(connector));
+    wut_join(acceptor_id);
+    run_clients("wut tcp loopback");
+    close(listen_fd);
+
+    // pthreads, blocking I/O
+    pthread_t servers[MAX_CONNECTIONS], clients[MAX_CONNECTIONS];
+    for (int i = 0; i < connections; ++i) {
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        server_fds[i] = sv[0];
+        client_fds[i] = sv[1];
+    }
+    long long start = now_ns();
+    for (int i = 0; i < connections; ++i) {
+        pthread_create(&servers[i], NULL, blocking_echo, &server_fds[i]);
+        pthread_create(&clients[i], NULL, blocking_client, &client_fds[i]);
+    }
+    for (int i = 0; i < connections; ++i) {
+        pthread_join(clients[i], NULL);
+        pthread_join(servers[i], NULL);
+    }
+    report("pthread socketpair", start, now_ns());
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+
+/* Thread ID bookkeeping at scale: create N threads that stay alive, cancel
+ * every one of them, join them all, then create N again so every ID comes
+ * from the free list. Each phase reports the average cost per call, which
+ * should stay flat as N grows. Last, N threads that run to completion are
+ * reaped through a group with a single wait. Stacks are the minimum size
+ * with no guard, so we're measuring wut and not the kernel's mapping
+ * limits.
+ */
+
+#define DEFAULT_THREADS 1000000
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void run(void) {
+}
+
+static void report(const char* phase, int count, long long start, long long end) {
+    printf("%s: %.1f ns per call\n", phase, (double) (end - start) / count);
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+
+    wut_init();
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.stack_size = 0;
+    attr.guard_size = 0;
+
+    for (int round = 0; round < 2; ++round) {
+        long long start = now_ns();
+        for (int i = 0; i < count; ++i) {
+            if (wut_create_ex(run, &attr) < 0) {
+                printf("wut_create_ex failed after %d threads\n", i);
+                return 1;
+            }
+        }
+        long long end = now_ns();
+        report(round == 0 ? "wut_create (new IDs)" : "wut_create (reused IDs)",
+               count, start, end);
+
+        start = now_ns();
+        for (int i = 1; i <= count; ++i) {
+            wut_cancel(i);
+        }
+        end = now_ns();
+        report("wut_cancel", count, start, end);
+
+        start = now_ns();
+        for (int i = 1; i <= count; ++i) {
+            wut_join(i);
+        }
+        end = now_ns();
+        report("wut_join", count, start, end);
+    }
+    printf("%d live threads\n", count);
+
+    // Threads that actually run and exit, all reaped through one group
+    wut_group group;
+    wut_group_init(&group);
+    attr.group = &group;
+    long long start = now_ns();
+    for (int i = 0; i < count; ++i) {
+        wut_create_ex(run, &attr);
+    }
+    int reaped = wut_group_wait(&group);
+    report("wut_create + wut_group_wait", reaped, start, now_ns());
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+
+/* Pipeline: a source thread sends numbers through a chain of stages, each
+ * its own thread that adds one and passes the number on over a channel,
+ * into a sink at the end. This runs with unbuffered, buffered and unbounded
+ * channels between the stages.
+ */
+
+#define DEFAULT_STAGES 8
+#define MAX_STAGES 1024
+#define DEFAULT_ITEMS 200000
+
+static int stages;
+static int items;
+static wut_chan * chans[MAX_STAGES + 1];
+static int next_stage;
+static long long sink_sum;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void source(void) {
+    for (long i = 0; i < items; ++i) {
+        wut_chan_send(chans[0], &i);
+    }
+    wut_chan_close(chans[0]);
+}
+
+static void stage(void) {
+    int index = next_stage++;
+    long value;
+    while (wut_chan_recv(chans[index], &value) == 0) {
+        ++value;
+        wut_chan_send(chans[index + 1], &value);
+    }
+    wut_chan_close(chans[index + 1]);
+}
+
+static void sink(void) {
+    long value;
+    while (wut_chan_recv(chans[stages], &value) == 0) {
+        sink_sum += value;
+    }
+}
+
+static void run(const char* name, long capacity) {
+    for (int i = 0; i <= stages; ++i) {
+        chans[i] = wut_chan_create(sizeof(long), capacity);
+    }
+    next_stage = 0;
+    sink_sum = 0;
+
+    long long start = now_ns();
+    int ids[MAX_STAGES + 2];
+    ids[0] = wut_create(source);
+    for (int i = 0; i < stages; ++i) {
+        ids[i + 1] = wut_create(stage);
+    }
+    ids[stages + 1] = wut_create(sink);
+    for (int i = 0; i < stages + 2; ++i) {
+        wut_join(ids[i]);
+    }
+    long long end = now_ns();
+
+    long long expected = (long long) items * (items - 1) / 2 + (long long) items * stages;
+    double hops = (double) items * (stages + 1);
+    printf("%s: %.0f items/s, %.1f ns per hop%s\n", name,
+           items * 1e9 / (end - start), (end - start) / hops,
+           sink_sum == expected ? "" : " (lost items!)");
+    for (int i = 0; i <= stages; ++i) {
+        wut_chan_destroy(chans[i]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    stages = argc > 1 ? atoi(argv[1]) : DEFAULT_STAGES;
+    if (stages < 1 || stages > MAX_STAGES) stages = DEFAULT_STAGES;
+    items = argc > 2 ? atoi(argv[2]) : DEFAULT_ITEMS;
+    int workers = argc > 3 ? atoi(argv[3]) : 1;
+
+    if (workers > 1) wut_init_workers(workers);
+    else wut_init();
+
+    run("unbuffered", 0);
+    run("buffered 64", 64);
+    run("unbounded", WUT_CHAN_UNBOUNDED);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi, qsort
+#include <time.h> // clock_gettime
+
+/* Interactive latency under load: background threads spin without ever
+ * yielding (preemption takes the CPU away from them), while a ticker
+ * thread wakes up every millisecond and hands a timestamp to an
+ * interactive thread over a channel. We report how long the interactive
+ * thread takes to run after that, with everyone at the same priority, with
+ * the ticker and the interactive thread at a higher priority, and with the
+ * MLFQ sorting it out on its own.
+ */
+
+#define DEFAULT_BACKGROUND 4
+#define MAX_BACKGROUND 256
+#define DEFAULT_SAMPLES 200
+#define MAX_SAMPLES 100000
+#define QUANTUM_USEC 500
+
+static int background;
+static int samples;
+static volatile int stop;
+static wut_chan * ticks;
+static long long latencies[MAX_SAMPLES];
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void spin(void) {
+    while (!stop) {
+    }
+}
+
+static void ticker(void) {
+    for (int i = 0; i < samples; ++i) {
+        wut_sleep_ns(1000 * 1000);
+        long long sent = now_ns();
+        wut_chan_send(ticks, &sent);
+    }
+}
+
+static void interactive(void) {
+    for (int i = 0; i < samples; ++i) {
+        long long sent;
+        wut_chan_recv(ticks, &sent);
+        latencies[i] = now_ns() - sent;
+    }
+    stop = 1;
+}
+
+static int compare(const void* a, const void* b) {
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char* name, int policy, int priority) {
+    wut_set_policy(policy);
+    stop = 0;
+    wut_attr attr;
+    wut_attr_init(&attr);
+    int ids[MAX_BACKGROUND + 2];
+    for (int i = 0; i < background; ++i) {
+        ids[i] = wut_create_ex(spin, &attr);
+    }
+    attr.priority = priority;
+    ids[background] = wut_create_ex(ticker, &attr);
+    ids[background + 1] = wut_create_ex(interactive, &attr);
+    for (int i = 0; i < background + 2; ++i) {
+        wut_join(ids[i]);
+    }
+
+    qsort(latencies, samples, sizeof(long long), compare);
+    long long sum = 0;
+    for (int i = 0; i < samples; ++i) {
+        sum += latencies[i];
+    }
+    printf("%s: avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n", name,
+           sum / 1e3 / samples, latencies[samples / 2] / 1e3,
+           latencies[samples * 99 / 100] / 1e3, latencies[samples - 1] / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+    background = argc > 1 ? atoi(argv[1]) : DEFAULT_BACKGROUND;
+    if (background < 0 || background > MAX_BACKGROUND) background = DEFAULT_BACKGROUND;
+    samples = argc > 2 ? atoi(argv[2]) : DEFAULT_SAMPLES;
+    if (samples < 1 || samples > MAX_SAMPLES) samples = DEFAULT_SAMPLES;
+
+    wut_init();
+    wut_set_quantum(QUANTUM_USEC);
+    ticks = wut_chan_create(sizeof(long long), 0);
+
+    run("same priority", WUT_SCHED_PRIORITY, WUT_PRIORITY_DEFAULT);
+    run("higher priority", WUT_SCHED_PRIORITY, WUT_PRIORITY_DEFAULT - 4);
+    run("mlfq", WUT_SCHED_MLFQ, WUT_PRIORITY_DEFAULT);
+    return 0;
+}
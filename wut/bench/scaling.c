@@ -0,0 +1,65 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi, exit
+#include <sys/wait.h> // waitpid
+#include <time.h> // clock_gettime
+#include <unistd.h> // fork
+
+/* Worker scaling: the same fixed amount of work, split over many threads
+ * that yield every so often, run with 1 to 64 workers. wut can only be
+ * initialised once per process, so every worker count runs in a child.
+ */
+
+#define DEFAULT_THREADS 1024
+#define MAX_THREADS 65536
+#define SLICES 100
+#define SLICE_WORK 20000
+
+static int threads;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void work(void) {
+    volatile unsigned sink = 0;
+    for (int i = 0; i < SLICES; ++i) {
+        for (int j = 0; j < SLICE_WORK; ++j) {
+            sink += j;
+        }
+        wut_yield();
+    }
+}
+
+static void run(int workers) {
+    static int ids[MAX_THREADS];
+    wut_init_workers(workers);
+    long long start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+        ids[i] = wut_create(work);
+    }
+    for (int i = 0; i < threads; ++i) {
+        wut_join(ids[i]);
+    }
+    long long end = now_ns();
+    printf("%2d workers: %8.1f ms\n", workers, (end - start) / 1e6);
+}
+
+int main(int argc, char* argv[]) {
+    threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    if (threads < 1 || threads > MAX_THREADS) threads = DEFAULT_THREADS;
+    printf("%d threads, %d cpus\n", threads, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    for (int workers = 1; workers <= 64; workers *= 2) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(workers);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "wut.h"
+
+#include <pthread.h> // pthread_create
+#include <semaphore.h> // sem_init
+#include <stdatomic.h> // atomic_int
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi, malloc
+#include <time.h> // clock_gettime
+#include <ucontext.h> // getcontext, makecontext, swapcontext
+#include <unistd.h> // sysconf
+
+/* Suite: the basic costs of a thread, for wut, pthreads and raw
+ * `swapcontext`, printed as CSV (benchmark,impl,value,unit) so runs can be
+ * compared with a spreadsheet or a script.
+ *
+ * - yield: one round trip between two threads, for pthreads a mutex and
+ *   condition variable handing a turn back and forth
+ * - create-join: a thread that does nothing, created and joined one at a
+ *   time
+ * - chain: every thread creates and joins the next, 255 deep like the
+ *   lots-of-threads test
+ * - idle-memory: resident memory per thread while all of them wait
+ */
+
+#define DEFAULT_ROUNDS 100000
+#define DEFAULT_IDLE 1000
+#define MAX_IDLE 65536
+#define CHAIN_DEPTH 255
+#define CHAINS 100
+#define STACK_SIZE (64 * 1024)
+
+static int rounds;
+static int idle;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long resident_bytes(void) {
+    long size = 0, resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void report(const char * benchmark, const char * impl, double value, const char * unit) {
+    printf("%s,%s,%.1f,%s\n", benchmark, impl, value, unit);
+}
+
+/* wut */
+
+static int chain_depth;
+static wut_sem idle_sem;
+
+static void wut_pong(void) {
+    for (int i = 0; i < rounds; ++i) {
+        wut_yield();
+    }
+}
+
+static void wut_nothing(void) {
+}
+
+static void wut_link(void) {
+    if (++chain_depth < CHAIN_DEPTH) {
+        wut_join(wut_create(wut_link));
+    }
+}
+
+static void wut_idle(void) {
+    wut_sem_wait(&idle_sem);
+}
+
+static void run_wut(void) {
+    wut_init();
+
+    int id = wut_create(wut_pong);
+    long long start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        wut_yield();
+    }
+    long long end = now_ns();
+    wut_join(id);
+    report("yield", "wut", (double) (end - start) / rounds, "ns");
+
+    start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        wut_join(wut_create(wut_nothing));
+    }
+    end = now_ns();
+    report("create-join", "wut", rounds * 1e9 / (end - start), "threads/s");
+
+    start = now_ns();
+    for (int i = 0; i < CHAINS; ++i) {
+        chain_depth = 0;
+        wut_join(wut_create(wut_link));
+    }
+    end = now_ns();
+    report("chain", "wut", (end - start) / 1e3 / CHAINS, "us");
+
+    static int ids[MAX_IDLE];
+    wut_sem_init(&idle_sem, 0);
+    long before = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        ids[i] = wut_create(wut_idle);
+    }
+    // Every new thread runs up to its wait before we get back
+    wut_yield();
+    long after = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        wut_sem_post(&idle_sem);
+    }
+    for (int i = 0; i < idle; ++i) {
+        wut_join(ids[i]);
+    }
+    report("idle-memory", "wut", (double) (after - before) / idle, "bytes");
+}
+
+/* pthread */
+
+static pthread_mutex_t turn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static int turn;
+static sem_t idle_posix_sem;
+static atomic_int idle_waiting;
+
+static void pass_turn(int from, int to) {
+    pthread_mutex_lock(&turn_mutex);
+    while (turn != from) {
+        pthread_cond_wait(&turn_cond, &turn_mutex);
+    }
+    turn = to;
+    pthread_cond_signal(&turn_cond);
+    pthread_mutex_unlock(&turn_mutex);
+}
+
+static void* pthread_pong(void* arg) {
+    (void) arg;
+    for (int i = 0; i < rounds; ++i) {
+        pass_turn(1, 0);
+    }
+    return NULL;
+}
+
+static void* pthread_nothing(void* arg) {
+    return arg;
+}
+
+static void* pthread_link(void* arg) {
+    int depth = (int) (long) arg;
+    if (depth + 1 < CHAIN_DEPTH) {
+        pthread_t next;
+        pthread_create(&next, NULL, pthread_link, (void*) (long) (depth + 1));
+        pthread_join(next, NULL);
+    }
+    return NULL;
+}
+
+static void* pthread_idle(void* arg) {
+    atomic_fetch_add(&idle_waiting, 1);
+    sem_wait(&idle_posix_sem);
+    return arg;
+}
+
+static void run_pthread(void) {
+    pthread_t thread;
+    turn = 0;
+    pthread_create(&thread, NULL, pthread_pong, NULL);
+    long long start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        pass_turn(0, 1);
+    }
+    long long end = now_ns();
+    pthread_join(thread, NULL);
+    report("yield", "pthread", (double) (end - start) / rounds, "ns");
+
+    start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        pthread_create(&thread, NULL, pthread_nothing, NULL);
+        pthread_join(thread, NULL);
+    }
+    end = now_ns();
+    report("create-join", "pthread", rounds * 1e9 / (end - start), "threads/s");
+
+    start = now_ns();
+    for (int i = 0; i < CHAINS; ++i) {
+        pthread_create(&thread, NULL, pthread_link, (void*) 0L);
+        pthread_join(thread, NULL);
+    }
+    end = now_ns();
+    report("chain", "pthread", (end - start) / 1e3 / CHAINS, "us");
+
+    static pthread_t threads[MAX_IDLE];
+    sem_init(&idle_posix_sem, 0, 0);
+    long before = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        pthread_create(&threads[i], NULL, pthread_idle, NULL);
+    }
+    while (atomic_load(&idle_waiting) < idle) {
+        sched_yield();
+    }
+    long after = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        sem_post(&idle_posix_sem);
+    }
+    for (int i = 0; i < idle; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    report("idle-memory", "pthread", (double) (after - before) / idle, "bytes");
+}
+
+/* swapcontext, a context per "thread" with a malloc'd stack. Joining is
+ * the context returning through uc_link. */
+
+static ucontext_t main_uc, pong_uc;
+static ucontext_t chain_ucs[CHAIN_DEPTH + 1];
+
+static void uc_pong(void) {
+    for (int i = 0; i < rounds; ++i) {
+        swapcontext(&pong_uc, &main_uc);
+    }
+}
+
+static void uc_nothing(void) {
+}
+
+static void uc_run(ucontext_t * uc, ucontext_t * link, void (*fn)(void), int argc, int arg) {
+    getcontext(uc);
+    uc->uc_stack.ss_sp = malloc(STACK_SIZE);
+    uc->uc_stack.ss_size = STACK_SIZE;
+    uc->uc_link = link;
+    makecontext(uc, fn, argc, arg);
+    swapcontext(link, uc);
+    free(uc->uc_stack.ss_sp);
+}
+
+static void uc_chain(int depth) {
+    if (depth + 1 < CHAIN_DEPTH) {
+        uc_run(&chain_ucs[depth + 1], &chain_ucs[depth], (void (*)(void)) uc_chain, 1, depth + 1);
+    }
+}
+
+static void uc_idle(void) {
+    swapcontext(&pong_uc, &main_uc);
+}
+
+static void run_swapcontext(void) {
+    static char stack[STACK_SIZE];
+    getcontext(&pong_uc);
+    pong_uc.uc_stack.ss_sp = stack;
+    pong_uc.uc_stack.ss_size = sizeof(stack);
+    pong_uc.uc_link = &main_uc;
+    makecontext(&pong_uc, uc_pong, 0);
+    long long start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        swapcontext(&main_uc, &pong_uc);
+    }
+    long long end = now_ns();
+    report("yield", "swapcontext", (double) (end - start) / rounds, "ns");
+
+    ucontext_t uc;
+    start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        uc_run(&uc, &main_uc, uc_nothing, 0, 0);
+    }
+    end = now_ns();
+    report("create-join", "swapcontext", rounds * 1e9 / (end - start), "threads/s");
+
+    start = now_ns();
+    for (int i = 0; i < CHAINS; ++i) {
+        uc_run(&chain_ucs[0], &main_uc, (void (*)(void)) uc_chain, 1, 0);
+    }
+    end = now_ns();
+    report("chain", "swapcontext", (end - start) / 1e3 / CHAINS, "us");
+
+    // Each context runs once and parks itself, they're never resumed
+    static void * stacks[MAX_IDLE];
+    long before = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        stacks[i] = malloc(STACK_SIZE);
+        getcontext(&pong_uc);
+        pong_uc.uc_stack.ss_sp = stacks[i];
+        pong_uc.uc_stack.ss_size = STACK_SIZE;
+        pong_uc.uc_link = NULL;
+        makecontext(&pong_uc, uc_idle, 0);
+        swapcontext(&main_uc, &pong_uc);
+    }
+    long after = resident_bytes();
+    for (int i = 0; i < idle; ++i) {
+        free(stacks[i]);
+    }
+    report("idle-memory", "swapcontext", (double) (after - before) / idle, "bytes");
+}
+
+int main(int argc, char* argv[]) {
+    rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    idle = argc > 2 ? atoi(argv[2]) : DEFAULT_IDLE;
+    if (idle < 1 || idle > MAX_IDLE) idle = DEFAULT_IDLE;
+
+    printf("benchmark,impl,value,unit\n");
+    run_wut();
+    run_pthread();
+    run_swapcontext();
+    return 0;
+}
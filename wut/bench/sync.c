@@ -0,0 +1,167 @@
+#include "wut.h"
+
+#include <pthread.h> // pthread_create, pthread_mutex_*, pthread_cond_*
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+
+/* Producer/consumer: pairs of threads pass items through one small bounded
+ * buffer, guarded by a mutex and two condition variables. The same loop
+ * runs on wut threads with wut_mutex/wut_cond, on wut threads with a pair
+ * of counting semaphores, and on pthreads with pthread_mutex/pthread_cond.
+ */
+
+#define DEFAULT_PAIRS 4
+#define MAX_PAIRS 256
+#define DEFAULT_ITEMS 100000
+#define SLOTS 16
+
+static int pairs;
+static int items;
+static int buffer[SLOTS];
+static int head, count;
+static long long consumed;
+
+static wut_mutex mutex;
+static wut_cond not_empty, not_full;
+static wut_sem free_slots, used_slots;
+static pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pnot_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pnot_full = PTHREAD_COND_INITIALIZER;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void put(int item) {
+    buffer[(head + count) % SLOTS] = item;
+    ++count;
+}
+
+static int take(void) {
+    int item = buffer[head];
+    head = (head + 1) % SLOTS;
+    --count;
+    return item;
+}
+
+static void producer(void) {
+    for (int i = 0; i < items; ++i) {
+        wut_mutex_lock(&mutex);
+        while (count == SLOTS) wut_cond_wait(&not_full, &mutex);
+        put(i);
+        wut_cond_signal(&not_empty);
+        wut_mutex_unlock(&mutex);
+    }
+}
+
+static void consumer(void) {
+    for (int i = 0; i < items; ++i) {
+        wut_mutex_lock(&mutex);
+        while (count == 0) wut_cond_wait(&not_empty, &mutex);
+        consumed += take();
+        wut_cond_signal(&not_full);
+        wut_mutex_unlock(&mutex);
+    }
+}
+
+// The semaphores count the slots, the mutex only guards the indices
+static void sem_producer(void) {
+    for (int i = 0; i < items; ++i) {
+        wut_sem_wait(&free_slots);
+        wut_mutex_lock(&mutex);
+        put(i);
+        wut_mutex_unlock(&mutex);
+        wut_sem_post(&used_slots);
+    }
+}
+
+static void sem_consumer(void) {
+    for (int i = 0; i < items; ++i) {
+        wut_sem_wait(&used_slots);
+        wut_mutex_lock(&mutex);
+        consumed += take();
+        wut_mutex_unlock(&mutex);
+        wut_sem_post(&free_slots);
+    }
+}
+
+static void* pthread_producer(void* arg) {
+    (void) arg;
+    for (int i = 0; i < items; ++i) {
+        pthread_mutex_lock(&pmutex);
+        while (count == SLOTS) pthread_cond_wait(&pnot_full, &pmutex);
+        put(i);
+        pthread_cond_signal(&pnot_empty);
+        pthread_mutex_unlock(&pmutex);
+    }
+    return NULL;
+}
+
+static void* pthread_consumer(void* arg) {
+    (void) arg;
+    for (int i = 0; i < items; ++i) {
+        pthread_mutex_lock(&pmutex);
+        while (count == 0) pthread_cond_wait(&pnot_empty, &pmutex);
+        consumed += take();
+        pthread_cond_signal(&pnot_full);
+        pthread_mutex_unlock(&pmutex);
+    }
+    return NULL;
+}
+
+static void report(const char* name, long long start, long long end) {
+    long long expected = (long long) pairs * items * (items - 1) / 2;
+    double total = (double) pairs * items;
+    printf("%s: %.1f ns per item%s\n", name, (end - start) / total,
+           consumed == expected ? "" : " (lost items!)");
+}
+
+static void run_wut(const char* name, void (*produce)(void), void (*consume)(void)) {
+    int ids[2 * MAX_PAIRS];
+    head = count = 0;
+    consumed = 0;
+    long long start = now_ns();
+    for (int i = 0; i < pairs; ++i) {
+        ids[2 * i] = wut_create(produce);
+        ids[2 * i + 1] = wut_create(consume);
+    }
+    for (int i = 0; i < 2 * pairs; ++i) {
+        wut_join(ids[i]);
+    }
+    report(name, start, now_ns());
+}
+
+int main(int argc, char* argv[]) {
+    pairs = argc > 1 ? atoi(argv[1]) : DEFAULT_PAIRS;
+    if (pairs < 1 || pairs > MAX_PAIRS) pairs = DEFAULT_PAIRS;
+    items = argc > 2 ? atoi(argv[2]) : DEFAULT_ITEMS;
+    int workers = argc > 3 ? atoi(argv[3]) : 1;
+
+    if (workers > 1) wut_init_workers(workers);
+    else wut_init();
+    wut_mutex_init(&mutex);
+    wut_cond_init(&not_empty);
+    wut_cond_init(&not_full);
+    wut_sem_init(&free_slots, SLOTS);
+    wut_sem_init(&used_slots, 0);
+
+    run_wut("wut mutex+cond", producer, consumer);
+    run_wut("wut semaphores", sem_producer, sem_consumer);
+
+    pthread_t threads[2 * MAX_PAIRS];
+    head = count = 0;
+    consumed = 0;
+    long long start = now_ns();
+    for (int i = 0; i < pairs; ++i) {
+        pthread_create(&threads[2 * i], NULL, pthread_producer, NULL);
+        pthread_create(&threads[2 * i + 1], NULL, pthread_consumer, NULL);
+    }
+    for (int i = 0; i < 2 * pairs; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    report("pthread mutex+cond", start, now_ns());
+    return 0;
+}
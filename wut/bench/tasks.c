@@ -0,0 +1,68 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+
+/* Short tasks: a batch of tiny tasks run once as a thread each (created,
+ * then joined), and once through wut_spawn_task with a wait group. Each
+ * task only adds to a counter, so this is the cost of getting it run.
+ */
+
+#define DEFAULT_TASKS 1000000
+#define BATCH 1000
+
+static int tasks;
+static long counter;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void thread_task(void) {
+    counter++;
+}
+
+static void pool_task(void * arg) {
+    counter += (long) arg;
+}
+
+static void report(const char * name, long long start, long long end) {
+    printf("%s: %.1f ns per task, %.0f tasks/s\n", name,
+           (double) (end - start) / tasks, tasks * 1e9 / (end - start));
+}
+
+int main(int argc, char* argv[]) {
+    tasks = argc > 1 ? atoi(argv[1]) : DEFAULT_TASKS;
+    if (tasks < BATCH) tasks = BATCH;
+    tasks -= tasks % BATCH;
+
+    wut_init();
+
+    static int ids[BATCH];
+    long long start = now_ns();
+    for (int done = 0; done < tasks; done += BATCH) {
+        for (int i = 0; i < BATCH; ++i) {
+            ids[i] = wut_create(thread_task);
+        }
+        for (int i = 0; i < BATCH; ++i) {
+            wut_join(ids[i]);
+        }
+    }
+    report("wut_create + wut_join", start, now_ns());
+
+    wut_waitgroup wg;
+    wut_waitgroup_init(&wg);
+    wut_task_pool_start(4, BATCH);
+    start = now_ns();
+    for (int done = 0; done < tasks; done += BATCH) {
+        for (int i = 0; i < BATCH; ++i) {
+            wut_spawn_task(pool_task, (void*) 1L, &wg);
+        }
+        wut_waitgroup_wait(&wg);
+    }
+    report("wut_spawn_task + wait group", start, now_ns());
+    return counter == 2L * tasks ? 0 : 1;
+}
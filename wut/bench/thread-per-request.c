@@ -0,0 +1,80 @@
+#include <pthread.h> // pthread_create
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+
+/* Thread per request: plain pthreads code, the way a server that starts a
+ * detached thread for every request is written. Each request does a bit
+ * of work, then updates shared counters under a mutex, and the dispatcher
+ * waits on a condition variable whenever too many are in flight. Built
+ * twice, bench-thread-per-request runs on kernel threads and
+ * bench-thread-per-request-wut is linked with the pthread shim (running the
+ * first with LD_PRELOAD=libwut-pthread.so does the same).
+ */
+
+#define DEFAULT_REQUESTS 100000
+#define DEFAULT_IN_FLIGHT 256
+#define REQUEST_WORK 2000
+
+static int requests;
+static int max_in_flight;
+static int in_flight;
+static long handled;
+static unsigned long checksum;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t room = PTHREAD_COND_INITIALIZER;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void* handle(void* arg) {
+    unsigned long hash = (unsigned long) arg;
+    for (int i = 0; i < REQUEST_WORK; ++i) {
+        hash = hash * 31 + i;
+    }
+    pthread_mutex_lock(&lock);
+    handled++;
+    checksum += hash;
+    in_flight--;
+    pthread_cond_signal(&room);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    requests = argc > 1 ? atoi(argv[1]) : DEFAULT_REQUESTS;
+    max_in_flight = argc > 2 ? atoi(argv[2]) : DEFAULT_IN_FLIGHT;
+    if (max_in_flight < 1) max_in_flight = DEFAULT_IN_FLIGHT;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    long long start = now_ns();
+    for (long i = 0; i < requests; ++i) {
+        pthread_mutex_lock(&lock);
+        while (in_flight == max_in_flight) {
+            pthread_cond_wait(&room, &lock);
+        }
+        in_flight++;
+        pthread_mutex_unlock(&lock);
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, handle, (void*) i) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    pthread_mutex_lock(&lock);
+    while (in_flight > 0) {
+        pthread_cond_wait(&room, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    long long end = now_ns();
+
+    printf("%s: %ld requests, %.0f requests/s, %.1f us per request\n", argv[0],
+           handled, handled * 1e9 / (end - start), (end - start) / 1e3 / handled);
+    return 0;
+}
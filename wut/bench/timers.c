@@ -0,0 +1,77 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi, malloc
+#include <sys/resource.h> // getrusage
+#include <time.h> // clock_gettime
+
+/* Timers: lots of threads each sleep for a different time between 1 ms and
+ * 1 s. We report how late they wake up, and how much CPU the process burns
+ * while everyone is asleep (the idle worker should be blocked in the kernel
+ * rather than ticking through the wheel).
+ */
+
+#define DEFAULT_THREADS 100000
+#define MS 1000000LL
+
+static int threads;
+static int started;
+static long long* lateness;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double cpu_ms(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3 +
+           ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+}
+
+static void sleeper(void) {
+    int index = started++;
+    long long ns = (index * 7919LL % 1000 + 1) * MS;
+    long long deadline = now_ns() + ns;
+    wut_sleep_ns(ns);
+    lateness[index] = now_ns() - deadline;
+}
+
+int main(int argc, char* argv[]) {
+    threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    lateness = malloc(threads * sizeof(long long));
+    int* ids = malloc(threads * sizeof(int));
+
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.stack_size = 0;
+    attr.guard_size = 0;
+
+    wut_init();
+    long long start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+        ids[i] = wut_create_ex(sleeper, &attr);
+    }
+    long long created = now_ns();
+    double cpu_start = cpu_ms();
+    for (int i = 0; i < threads; ++i) {
+        wut_join(ids[i]);
+    }
+    long long end = now_ns();
+    double cpu_end = cpu_ms();
+
+    long long total = 0, max = 0;
+    for (int i = 0; i < threads; ++i) {
+        total += lateness[i];
+        if (lateness[i] > max) max = lateness[i];
+    }
+    printf("%d timers, created in %.1f ms, all done after %.1f ms\n",
+           threads, (created - start) / 1e6, (end - start) / 1e6);
+    printf("lateness: %.3f ms average, %.3f ms max\n",
+           (double) total / threads / 1e6, max / 1e6);
+    printf("cpu while sleeping: %.1f ms (%.1f ns per timer)\n",
+           cpu_end - cpu_start, (cpu_end - cpu_start) * 1e6 / threads);
+    return 0;
+}
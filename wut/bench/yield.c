@@ -0,0 +1,66 @@
+#include "wut.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // atoi
+#include <time.h> // clock_gettime
+#include <ucontext.h> // getcontext, makecontext, swapcontext
+
+/* Yield ping-pong: two threads hand the CPU back and forth with
+ * `wut_yield`, and we report the cost of a single switch. For reference we
+ * do the same thing with raw `swapcontext`, which is what wut used to do.
+ */
+
+#define DEFAULT_ROUNDS 1000000
+#define STACK_SIZE (64 * 1024)
+
+static int rounds;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void ping(void) {
+    for (int i = 0; i < rounds; ++i) {
+        wut_yield();
+    }
+}
+
+static ucontext_t main_uc, pong_uc;
+
+static void pong(void) {
+    for (int i = 0; i < rounds; ++i) {
+        swapcontext(&pong_uc, &main_uc);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+
+    wut_init();
+    int id = wut_create(ping);
+    long long start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        wut_yield();
+    }
+    long long end = now_ns();
+    wut_join(id);
+    printf("wut_yield: %.1f ns per switch\n",
+           (double) (end - start) / (2.0 * rounds));
+
+    static char stack[STACK_SIZE];
+    getcontext(&pong_uc);
+    pong_uc.uc_stack.ss_sp = stack;
+    pong_uc.uc_stack.ss_size = sizeof(stack);
+    pong_uc.uc_link = &main_uc;
+    makecontext(&pong_uc, pong, 0);
+    start = now_ns();
+    for (int i = 0; i < rounds; ++i) {
+        swapcontext(&main_uc, &pong_uc);
+    }
+    end = now_ns();
+    printf("swapcontext: %.1f ns per switch\n",
+           (double) (end - start) / (2.0 * rounds));
+    return 0;
+}
@@ -1,12 +1,234 @@
 #ifndef WUT_H
 #define WUT_H
 
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// A group collects the exit status of the threads created in it, see
+// wut_join_any and wut_group_wait
+typedef struct wut_group { void * opaque[6]; } wut_group;
+
+// Priority levels, 0 is the most urgent. A worker always picks the most
+// urgent thread it has queued, threads at the same level take turns. A
+// preempted thread keeps running unless a thread at least as urgent is
+// queued, but wut_yield always gives way to the next thread.
+#define WUT_PRIORITY_LEVELS 16
+#define WUT_PRIORITY_DEFAULT 8
+// Scheduling policies for wut_set_policy. WUT_SCHED_PRIORITY keeps every
+// thread at the level it was given. WUT_SCHED_MLFQ moves a thread that
+// gets preempted (see wut_set_quantum) down a level each time, and back to
+// its own level once it blocks.
+#define WUT_SCHED_PRIORITY 0
+#define WUT_SCHED_MLFQ 1
+
+// Stack size is rounded up to a power of two (at least 16 KiB) and only
+// the pages a thread touches are committed. A guard_size of 0 disables the
+// guard below the stack. A thread created with a group can't be joined
+// with wut_join, the group reaps it. New threads start at
+// WUT_PRIORITY_DEFAULT. A growable stack reserves stack_size but starts
+// with a single accessible page, and grows on demand up to the guard
+// (always at least a page), where the process aborts. It only pays off
+// under strict overcommit, where it counts just the grown part. A thread
+// with a growable stack is never preempted, it runs until it blocks or
+// yields.
+typedef struct wut_attr {
+    size_t stack_size;
+    size_t guard_size;
+    wut_group * group;
+    int priority;
+    int growable;
+} wut_attr;
+
+// Locks for wut threads. Waiting only blocks the calling thread, and a
+// release hands the lock (or semaphore count) straight to the longest
+// waiting thread. Zeroed memory is not a valid lock, call the _init
+// function first.
+typedef struct wut_mutex { void * opaque[4]; } wut_mutex;
+typedef struct wut_cond { void * opaque[4]; } wut_cond;
+typedef struct wut_sem { void * opaque[4]; } wut_sem;
+typedef struct wut_rwlock { void * opaque[4]; } wut_rwlock;
+// A wait group counts outstanding work, wut_waitgroup_wait returns once
+// the count is back at zero
+typedef struct wut_waitgroup { void * opaque[4]; } wut_waitgroup;
+
+// Channels pass fixed size elements (copied in and out) between threads.
+// A capacity of 0 makes every send wait for a receiver, and
+// WUT_CHAN_UNBOUNDED never makes a sender wait.
+typedef struct wut_chan wut_chan;
+#define WUT_CHAN_UNBOUNDED (-1L)
+#define WUT_CHAN_SEND 0
+#define WUT_CHAN_RECV 1
+
+typedef struct wut_chan_case {
+    wut_chan * chan; // NULL cases are skipped
+    int op; // WUT_CHAN_SEND or WUT_CHAN_RECV
+    void * elem; // what to send, or where to receive into
+    int result; // set for the case that went ahead, like send/recv return
+} wut_chan_case;
+
+// Keys for per-thread values, `__thread` variables belong to whichever
+// worker runs the thread. Every thread starts out with NULL for every key.
+// When a thread exits, each key's destructor gets the value the thread
+// still holds (if not NULL), again up to WUT_DESTRUCTOR_ITERATIONS times
+// while destructors keep setting values. Keys can't be deleted.
+typedef int wut_key;
+#define WUT_KEYS_MAX 64
+#define WUT_DESTRUCTOR_ITERATIONS 4
+
+// Where a thread's time went while tracing was on
+typedef struct wut_stats {
+    unsigned long long cpu_ns; // running
+    unsigned long long runnable_ns; // queued, waiting for a worker
+    unsigned long switches; // times it was switched to
+} wut_stats;
+
+// Peak stack usage of the threads that exited while stack usage was being
+// measured, see wut_stack_usage_start. Bucket i counts the threads that
+// used at most 4 KiB << i, the last bucket also counts everything bigger.
+#define WUT_STACK_BUCKETS 16
+typedef struct wut_stack_histogram {
+    unsigned long threads;
+    size_t max; // the largest peak
+    unsigned long buckets[WUT_STACK_BUCKETS];
+} wut_stack_histogram;
+
 void wut_init(void);
+// Run wut threads on `workers` kernel threads instead of one. The calling
+// thread becomes worker 0. Threads may move between workers whenever they
+// yield or join, so don't keep pointers to thread-local variables across
+// those calls.
+int wut_init_workers(int workers);
+void wut_attr_init(wut_attr * attr);
 int wut_create(void (*run)(void));
+int wut_create_ex(void (*run)(void), const wut_attr * attr);
+// Like wut_create_ex, `run` gets `arg`. `attr` may be NULL.
+int wut_create_arg(void (*run)(void *), void * arg, const wut_attr * attr);
+// -1 when the caller isn't a wut thread: before wut_init, or on a kernel
+// thread wut doesn't run threads on
 int wut_id(void);
 int wut_yield(void);
 int wut_cancel(int id);
+// Any number of threads can join the same thread, all of them get its
+// exit status
 int wut_join(int id);
+// Like wut_join, but gives up after `ns` nanoseconds with -1 and errno set
+// to ETIMEDOUT. The thread can still be joined later.
+int wut_join_timeout(int id, long ns);
+// Timers have a resolution of 1 ms, a sleep never ends early
+int wut_sleep_ns(long ns);
 void wut_exit(int status);
+int wut_group_init(wut_group * group);
+// Reaps one exited thread of the group, waiting for one if needed. Returns
+// its ID and stores its exit status, or -1 with errno set to ECHILD once
+// there's nothing left to reap.
+int wut_join_any(wut_group * group, int * status);
+// Waits until every thread in the group has exited and reaps them all,
+// returns how many there were
+int wut_group_wait(wut_group * group);
+// Returns -1 with errno set to EAGAIN once WUT_KEYS_MAX keys exist. The
+// destructor may be NULL.
+int wut_key_create(wut_key * key, void (*destructor)(void *));
+void * wut_getspecific(wut_key key);
+int wut_setspecific(wut_key key, const void * value);
+// Like read, write and accept, but when the call would block only the
+// calling thread waits, the worker runs other threads meanwhile. The fd has
+// to be non-blocking (accepted sockets already are), and only one thread
+// should wait on an fd at a time.
+ssize_t wut_read(int fd, void * buf, size_t count);
+ssize_t wut_write(int fd, const void * buf, size_t count);
+int wut_accept(int fd, struct sockaddr * addr, socklen_t * addrlen);
+// Wait until `fd` is ready for any of `events` (POLLIN, POLLOUT), returns
+// the ready events
+int wut_poll(int fd, int events);
+// Unlocking a mutex the caller doesn't hold, or locking one it already
+// holds, returns -1
+int wut_mutex_init(wut_mutex * mutex);
+int wut_mutex_lock(wut_mutex * mutex);
+int wut_mutex_trylock(wut_mutex * mutex);
+int wut_mutex_unlock(wut_mutex * mutex);
+// A woken thread gets the mutex back before wut_cond_wait returns. There
+// are no spurious wakeups, but re-check the condition anyway since another
+// thread may have changed it first.
+int wut_cond_init(wut_cond * cond);
+int wut_cond_wait(wut_cond * cond, wut_mutex * mutex);
+// Like wut_cond_wait, but gives up after `ns` nanoseconds with -1 and errno
+// set to ETIMEDOUT. The mutex is held again either way.
+int wut_cond_wait_timeout(wut_cond * cond, wut_mutex * mutex, long ns);
+int wut_cond_signal(wut_cond * cond);
+int wut_cond_broadcast(wut_cond * cond);
+int wut_sem_init(wut_sem * sem, unsigned value);
+int wut_sem_wait(wut_sem * sem);
+int wut_sem_post(wut_sem * sem);
+// Readers don't get in ahead of a waiting writer
+int wut_rwlock_init(wut_rwlock * rwlock);
+int wut_rwlock_rdlock(wut_rwlock * rwlock);
+int wut_rwlock_wrlock(wut_rwlock * rwlock);
+int wut_rwlock_unlock(wut_rwlock * rwlock);
+int wut_waitgroup_init(wut_waitgroup * wg);
+// Returns -1 if the count would go below zero
+int wut_waitgroup_add(wut_waitgroup * wg, long delta);
+int wut_waitgroup_done(wut_waitgroup * wg);
+int wut_waitgroup_wait(wut_waitgroup * wg);
+wut_chan * wut_chan_create(size_t elem_size, long capacity);
+// Returns -1 with errno set to EPIPE if the channel is (or gets) closed
+int wut_chan_send(wut_chan * chan, const void * elem);
+// Returns -1 once the channel is closed and every element sent before
+// that has been received
+int wut_chan_recv(wut_chan * chan, void * elem);
+int wut_chan_close(wut_chan * chan);
+// Only once no thread uses the channel any more
+void wut_chan_destroy(wut_chan * chan);
+// Waits until one of the cases can go ahead, does it and returns its
+// index. Ready cases are taken in turn. When `block` is 0 and no case is
+// ready, returns -1 with errno set to EAGAIN instead.
+int wut_select(wut_chan_case * cases, int count, int block);
+// Tasks run on a fixed pool of wut threads that take them from a queue in
+// order, so spawning one creates no thread. Start the pool with `threads`
+// threads and room for `queue_size` waiting tasks, otherwise the first
+// wut_spawn_task starts one with 4 threads per worker and 256 slots. Returns
+// -1 with errno set to EBUSY if the pool already runs.
+int wut_task_pool_start(int threads, long queue_size);
+// Queues fn(arg), waiting for a free slot while the queue is full. With a
+// wait group, it's added to now and done once the task returns. Tasks
+// share the pool's threads, so a task that waits for tasks queued after it
+// can wait forever, and thread-local values stay from one task to the next.
+int wut_spawn_task(void (*fn)(void *), void * arg, wut_waitgroup * wg);
+void wut_set_cache_limit(int limit);
+// Preempt a thread that runs for more than `usec` microseconds of CPU time
+// without yielding, 0 turns it off. Can be called before or after
+// wut_init. A preempted thread may be in the middle of anything, so wrap
+// calls into code that isn't reentrant (malloc, stdio, ...) in
+// wut_preempt_disable/enable.
+int wut_set_quantum(long usec);
+int wut_set_priority(int id, int priority);
+int wut_get_priority(int id);
+int wut_set_policy(int policy);
+// Record scheduler events (create, switch, block, wake, exit) into a ring
+// of `events` per worker, and count per-thread time for wut_get_stats.
+// With 0 events only the counters are kept. Call it after wut_init, the
+// ring size can't change once set.
+int wut_trace_start(size_t events);
+void wut_trace_stop(void);
+// Writes what the rings hold as Chrome trace JSON, which Perfetto and
+// chrome://tracing open. Best called after wut_trace_stop.
+int wut_trace_dump(const char * path);
+// Only counts while tracing, and only until the thread is joined
+int wut_get_stats(int id, wut_stats * stats);
+// Measure the stack of every thread that exits from now on, from the pages
+// it got committed (so in whole pages), into the histogram. With `fd` >= 0
+// a line with the thread's peak is also written there for each of them.
+// While measuring, stacks go back to the cache empty, which costs a
+// madvise per exit but keeps one thread's peak from counting for the next.
+int wut_stack_usage_start(int fd);
+void wut_stack_usage_stop(void);
+int wut_get_stack_histogram(wut_stack_histogram * hist);
+// Bytes of stack the thread has used so far, or at its exit if it exited
+// while measuring. Returns -1 for the main thread, which runs on the
+// process stack. Without measuring, a stack from the cache may still count
+// what an earlier thread used.
+long wut_stack_peak(int id);
+void wut_preempt_disable(void);
+void wut_preempt_enable(void);
 
 #endif
@@ -0,0 +1,378 @@
+#include "wut.h"
+
+#include <dlfcn.h> // dlsym, RTLD_NEXT
+#include <errno.h> // EBUSY, EDEADLK, EINVAL, ETIMEDOUT
+#include <pthread.h> // pthread_*
+#include <sched.h> // sched_yield
+#include <stdatomic.h> // atomic_*
+#include <stdbool.h> // bool
+#include <stdlib.h> // abort, getenv, malloc
+#include <time.h> // clock_gettime
+
+/* pthread shim: runs a program written against pthreads on wut threads.
+ * Link it in ahead of libc, or load it with LD_PRELOAD=libwut-pthread.so,
+ * and pthread_create, pthread_join, pthread_detach, pthread_exit,
+ * pthread_self, sched_yield and the mutex and condition variable calls go
+ * to wut instead. WUT_WORKERS picks the number of workers (1, the default,
+ * is M:1).
+ *
+ * What doesn't carry over:
+ * - Mutex attributes are ignored, every mutex is a plain one that refuses
+ *   to be locked twice (EDEADLK) and unlocked by a non-owner (EPERM).
+ * - Condition variable attributes other than the clock are ignored. A
+ *   timed wait turns its deadline into a timeout when it starts, so setting
+ *   the clock doesn't move it, and it ends on a 1 ms timer tick.
+ * - Threads started with wut_create (or the task pool) get a pthread_t
+ *   the first time they ask for one, but it can't be joined or detached.
+ * - pthread_cancel, pthread_kill and the other calls taking a pthread_t
+ *   still go to libc, and don't work on shim threads.
+ * - Blocking system calls block the worker, not just the calling thread.
+ * - Calls from a kernel thread that isn't running wut threads (one started
+ *   before the shim, or by some other means) go to libc. Mutexes,
+ *   condition variables and pthread_ts can't be shared between such a
+ *   thread and wut threads.
+ */
+
+// A pthread_t is a pointer to one of these
+typedef struct shim_thread{
+    int id; // wut thread ID
+    atomic_int state; // SHIM_DETACHED | SHIM_FINISHED, or SHIM_FOREIGN
+    void * (*start)(void *);
+    void * arg;
+    void * result;
+} shim_thread;
+
+#define SHIM_DETACHED 1
+#define SHIM_FINISHED 2
+#define SHIM_FOREIGN 4 // a wut thread the shim didn't start
+
+// Mutexes and condition variables live inside the pthread object. The
+// static initialisers leave it zeroed, so the wut object is set up on
+// first use.
+#define SHIM_UNSET 0
+#define SHIM_SETTING 1
+#define SHIM_SET 2
+
+typedef struct shim_mutex{
+    atomic_int state;
+    wut_mutex mutex;
+} shim_mutex;
+
+typedef struct shim_cond{
+    atomic_int state;
+    wut_cond cond;
+    clockid_t clock; // timed wait deadlines, zero is CLOCK_REALTIME
+} shim_cond;
+
+_Static_assert(sizeof (shim_mutex) <= sizeof (pthread_mutex_t), "pthread_mutex_t is too small");
+_Static_assert(sizeof (shim_cond) <= sizeof (pthread_cond_t), "pthread_cond_t is too small");
+_Static_assert(CLOCK_REALTIME == 0, "a zeroed condition variable should use CLOCK_REALTIME");
+
+/* Start */
+// Calls from anything but a wut thread go to libc: wut_init_workers' own
+// while it runs, a library constructor that runs before us, or a kernel
+// thread wut doesn't run threads on (its workers', or one the program
+// started some other way)
+static int shim_state = SHIM_UNSET;
+static int (*real_create)(pthread_t *, const pthread_attr_t *, void * (*)(void *), void *);
+static int (*real_join)(pthread_t, void **);
+static int (*real_detach)(pthread_t);
+static void (*real_exit)(void *);
+static pthread_t (*real_self)(void);
+static int (*real_sched_yield)(void);
+static int (*real_mutex_init)(pthread_mutex_t *, const pthread_mutexattr_t *);
+static int (*real_mutex_destroy)(pthread_mutex_t *);
+static int (*real_mutex_lock)(pthread_mutex_t *);
+static int (*real_mutex_trylock)(pthread_mutex_t *);
+static int (*real_mutex_unlock)(pthread_mutex_t *);
+static int (*real_cond_init)(pthread_cond_t *, const pthread_condattr_t *);
+static int (*real_cond_destroy)(pthread_cond_t *);
+static int (*real_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+static int (*real_cond_clockwait)(pthread_cond_t *, pthread_mutex_t *, clockid_t, const struct timespec *);
+static int (*real_cond_signal)(pthread_cond_t *);
+static int (*real_cond_broadcast)(pthread_cond_t *);
+
+static shim_thread main_thread;
+static wut_key self_key;
+static size_t stack_size;
+// Detached threads that finished, the reaper joins them
+static wut_chan * reap_chan;
+
+static void reaper(void){
+    shim_thread * th;
+    while(wut_chan_recv(reap_chan, &th) == 0){
+        wut_join(th->id);
+        free(th);
+    }
+}
+
+// Only the handles pthread_self made up go with their thread, the shim's
+// own threads are freed once they're joined
+static void forget_foreign(void * value){
+    shim_thread * th = (shim_thread*) value;
+    if(atomic_load(&th->state) & SHIM_FOREIGN) free(th);
+}
+
+static __attribute__((constructor)) void shim_start(void){
+    if(shim_state != SHIM_UNSET) return;
+    shim_state = SHIM_SETTING;
+    // The POSIX way around ISO C not converting void * to a function pointer
+    *(void **) &real_create = dlsym(RTLD_NEXT, "pthread_create");
+    *(void **) &real_join = dlsym(RTLD_NEXT, "pthread_join");
+    *(void **) &real_detach = dlsym(RTLD_NEXT, "pthread_detach");
+    *(void **) &real_exit = dlsym(RTLD_NEXT, "pthread_exit");
+    *(void **) &real_self = dlsym(RTLD_NEXT, "pthread_self");
+    *(void **) &real_sched_yield = dlsym(RTLD_NEXT, "sched_yield");
+    *(void **) &real_mutex_init = dlsym(RTLD_NEXT, "pthread_mutex_init");
+    *(void **) &real_mutex_destroy = dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+    *(void **) &real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    *(void **) &real_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+    *(void **) &real_mutex_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+    *(void **) &real_cond_init = dlsym(RTLD_NEXT, "pthread_cond_init");
+    *(void **) &real_cond_destroy = dlsym(RTLD_NEXT, "pthread_cond_destroy");
+    *(void **) &real_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+    *(void **) &real_cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    *(void **) &real_cond_clockwait = dlsym(RTLD_NEXT, "pthread_cond_clockwait");
+    *(void **) &real_cond_signal = dlsym(RTLD_NEXT, "pthread_cond_signal");
+    *(void **) &real_cond_broadcast = dlsym(RTLD_NEXT, "pthread_cond_broadcast");
+    // New threads get as much stack as a pthread would, only what they
+    // touch is committed
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr, &stack_size);
+    pthread_attr_destroy(&attr);
+
+    const char * workers = getenv("WUT_WORKERS");
+    wut_init_workers(workers == NULL || atoi(workers) < 1 ? 1 : atoi(workers));
+    shim_state = SHIM_SET;
+
+    main_thread.id = wut_id();
+    wut_key_create(&self_key, forget_foreign);
+    wut_setspecific(self_key, &main_thread);
+    reap_chan = wut_chan_create(sizeof (shim_thread*), WUT_CHAN_UNBOUNDED);
+    wut_create(reaper);
+}
+
+// True while wut itself is starting up, or when the caller isn't a wut
+// thread at all
+static bool outside_wut(void){
+    shim_start();
+    return shim_state != SHIM_SET || wut_id() < 0;
+}
+
+/* Threads */
+static void finish(shim_thread * th, void * result){
+    th->result = result;
+    if(atomic_fetch_or(&th->state, SHIM_FINISHED) & SHIM_DETACHED){
+        wut_chan_send(reap_chan, &th);
+    }
+    wut_exit(0);
+}
+
+static void run(void * arg){
+    shim_thread * th = (shim_thread*) arg;
+    wut_setspecific(self_key, th);
+    finish(th, th->start(th->arg));
+}
+
+int pthread_create(pthread_t * thread, const pthread_attr_t * attr, void * (*start)(void *), void * arg){
+    if(outside_wut()) return real_create(thread, attr, start, arg);
+    shim_thread * th = (shim_thread*) malloc(sizeof (shim_thread));
+    if(th == NULL) return EAGAIN;
+    th->start = start;
+    th->arg = arg;
+    th->result = NULL;
+    atomic_init(&th->state, 0);
+    wut_attr wattr;
+    wut_attr_init(&wattr);
+    wattr.stack_size = stack_size;
+    if(attr != NULL){
+        int detach;
+        pthread_attr_getstacksize(attr, &wattr.stack_size);
+        pthread_attr_getdetachstate(attr, &detach);
+        if(detach == PTHREAD_CREATE_DETACHED) atomic_init(&th->state, SHIM_DETACHED);
+    }
+    // The new thread doesn't use its ID, and nobody has its pthread_t to
+    // join it with until we return
+    th->id = wut_create_arg(run, th, &wattr);
+    if(th->id < 0){
+        free(th);
+        return EAGAIN;
+    }
+    *thread = (pthread_t) th;
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void ** retval){
+    if(outside_wut()) return real_join(thread, retval);
+    shim_thread * th = (shim_thread*) thread;
+    if(th == wut_getspecific(self_key)) return EDEADLK;
+    if(atomic_load(&th->state) & (SHIM_DETACHED | SHIM_FOREIGN)) return EINVAL;
+    if(wut_join(th->id) < 0) return ESRCH;
+    if(retval != NULL) *retval = th->result;
+    if(th != &main_thread) free(th);
+    return 0;
+}
+
+int pthread_detach(pthread_t thread){
+    if(outside_wut()) return real_detach(thread);
+    shim_thread * th = (shim_thread*) thread;
+    if(atomic_load(&th->state) & SHIM_FOREIGN) return EINVAL;
+    int state = atomic_fetch_or(&th->state, SHIM_DETACHED);
+    if(state & SHIM_DETACHED) return EINVAL;
+    // Too late for it to hand itself to the reaper
+    if(state & SHIM_FINISHED){
+        wut_join(th->id);
+        free(th);
+    }
+    return 0;
+}
+
+void pthread_exit(void * retval){
+    if(outside_wut()) real_exit(retval);
+    shim_thread * th = (shim_thread*) wut_getspecific(self_key);
+    if(th == NULL || th == &main_thread || atomic_load(&th->state) & SHIM_FOREIGN) wut_exit(0);
+    else finish(th, retval);
+    __builtin_unreachable();
+}
+
+pthread_t pthread_self(void){
+    if(outside_wut()) return real_self();
+    shim_thread * th = (shim_thread*) wut_getspecific(self_key);
+    if(th != NULL) return (pthread_t) th;
+    // Started through wut directly, it gets a handle like the main thread's
+    th = (shim_thread*) malloc(sizeof (shim_thread));
+    if(th == NULL) abort();
+    th->id = wut_id();
+    th->start = NULL;
+    th->arg = NULL;
+    th->result = NULL;
+    atomic_init(&th->state, SHIM_FOREIGN);
+    wut_setspecific(self_key, th);
+    return (pthread_t) th;
+}
+
+// glibc's headers turn pthread_yield into sched_yield
+int sched_yield(void){
+    if(outside_wut()) return real_sched_yield();
+    wut_yield();
+    return 0;
+}
+
+/* Mutexes */
+// Sets up the wut object the first time any thread gets here
+static void lazy_init(atomic_int * state, void (*init)(void *), void * object){
+    if(atomic_load_explicit(state, memory_order_acquire) == SHIM_SET) return;
+    int unset = SHIM_UNSET;
+    if(atomic_compare_exchange_strong(state, &unset, SHIM_SETTING)){
+        init(object);
+        atomic_store_explicit(state, SHIM_SET, memory_order_release);
+        return;
+    }
+    while(atomic_load_explicit(state, memory_order_acquire) != SHIM_SET) wut_yield();
+}
+
+static void init_mutex(void * mutex){
+    wut_mutex_init((wut_mutex*) mutex);
+}
+
+static void init_cond(void * cond){
+    wut_cond_init((wut_cond*) cond);
+}
+
+static wut_mutex * get_mutex(pthread_mutex_t * mutex){
+    shim_mutex * m = (shim_mutex*) mutex;
+    lazy_init(&m->state, init_mutex, &m->mutex);
+    return &m->mutex;
+}
+
+static wut_cond * get_cond(pthread_cond_t * cond){
+    shim_cond * c = (shim_cond*) cond;
+    lazy_init(&c->state, init_cond, &c->cond);
+    return &c->cond;
+}
+
+int pthread_mutex_init(pthread_mutex_t * mutex, const pthread_mutexattr_t * attr){
+    if(outside_wut()) return real_mutex_init(mutex, attr);
+    shim_mutex * m = (shim_mutex*) mutex;
+    wut_mutex_init(&m->mutex);
+    atomic_store(&m->state, SHIM_SET);
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t * mutex){
+    if(outside_wut()) return real_mutex_destroy(mutex);
+    atomic_store(&((shim_mutex*) mutex)->state, SHIM_UNSET);
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t * mutex){
+    if(outside_wut()) return real_mutex_lock(mutex);
+    return wut_mutex_lock(get_mutex(mutex)) == 0 ? 0 : EDEADLK;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t * mutex){
+    if(outside_wut()) return real_mutex_trylock(mutex);
+    return wut_mutex_trylock(get_mutex(mutex)) == 0 ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t * mutex){
+    if(outside_wut()) return real_mutex_unlock(mutex);
+    return wut_mutex_unlock(get_mutex(mutex)) == 0 ? 0 : EPERM;
+}
+
+/* Condition Variables */
+int pthread_cond_init(pthread_cond_t * cond, const pthread_condattr_t * attr){
+    if(outside_wut()) return real_cond_init(cond, attr);
+    shim_cond * c = (shim_cond*) cond;
+    wut_cond_init(&c->cond);
+    c->clock = CLOCK_REALTIME;
+    if(attr != NULL) pthread_condattr_getclock(attr, &c->clock);
+    atomic_store(&c->state, SHIM_SET);
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t * cond){
+    if(outside_wut()) return real_cond_destroy(cond);
+    atomic_store(&((shim_cond*) cond)->state, SHIM_UNSET);
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t * cond, pthread_mutex_t * mutex){
+    if(outside_wut()) return real_cond_wait(cond, mutex);
+    return wut_cond_wait(get_cond(cond), get_mutex(mutex)) == 0 ? 0 : EPERM;
+}
+
+// Waits until `abstime` on `clock`
+static int wait_until(wut_cond * cond, pthread_mutex_t * mutex, clockid_t clock, const struct timespec * abstime){
+    struct timespec now;
+    if(clock_gettime(clock, &now) != 0) return EINVAL;
+    long long left = (abstime->tv_sec - now.tv_sec) * 1000000000LL + (abstime->tv_nsec - now.tv_nsec);
+    if(left <= 0) return ETIMEDOUT;
+    if(wut_cond_wait_timeout(cond, get_mutex(mutex), (long) left) == 0) return 0;
+    return errno == ETIMEDOUT ? ETIMEDOUT : EPERM;
+}
+
+int pthread_cond_timedwait(pthread_cond_t * cond, pthread_mutex_t * mutex, const struct timespec * abstime){
+    if(outside_wut()) return real_cond_timedwait(cond, mutex, abstime);
+    wut_cond * c = get_cond(cond);
+    return wait_until(c, mutex, ((shim_cond*) cond)->clock, abstime);
+}
+
+int pthread_cond_clockwait(pthread_cond_t * cond, pthread_mutex_t * mutex, clockid_t clock, const struct timespec * abstime){
+    if(outside_wut()) return real_cond_clockwait(cond, mutex, clock, abstime);
+    return wait_until(get_cond(cond), mutex, clock, abstime);
+}
+
+int pthread_cond_signal(pthread_cond_t * cond){
+    if(outside_wut()) return real_cond_signal(cond);
+    wut_cond_signal(get_cond(cond));
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t * cond){
+    if(outside_wut()) return real_cond_broadcast(cond);
+    wut_cond_broadcast(get_cond(cond));
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "context.h"
+
+#include <signal.h> // sigaddset
+#include <stdint.h> // uintptr_t
+#include <string.h> // memset
+
+#ifdef WUT_CONTEXT_UCONTEXT
+
+void context_init(context * ctx, char * stack, size_t size, void (*entry)(void)) {
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    ctx->uc.uc_stack.ss_flags = 0;
+    ctx->uc.uc_link = NULL;
+    makecontext(&ctx->uc, entry, 0);
+}
+
+void context_switch(context * from, context * to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+void context_block_signal(context * ctx, int sig) {
+    sigaddset(&ctx->uc.uc_sigmask, sig);
+}
+
+#elif defined(__x86_64__)
+
+/* The initial frame matches what `context_switch` in context-x86_64.S pops:
+ * MXCSR and the x87 control word, r15, r14, r13, r12, rbx, rbp, then the
+ * return address. We "return" into `entry` with the stack aligned the way a
+ * call would leave it, with a null return address above it. */
+void context_init(context * ctx, char * stack, size_t size, void (*entry)(void)) {
+    uintptr_t * sp = (uintptr_t *) (((uintptr_t) stack + size) & ~(uintptr_t) 15);
+    *--sp = 0; // entry's return address
+    *--sp = (uintptr_t) entry;
+    for (int i = 0; i < 6; i++) *--sp = 0;
+    *--sp = 0x037F00001F80; // default fpu control word << 32 | default mxcsr
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+/* The initial frame matches what `context_switch` in context-aarch64.S
+ * loads: x19-x28, x29 (frame pointer), x30 (link register), d8-d15. */
+void context_init(context * ctx, char * stack, size_t size, void (*entry)(void)) {
+    uintptr_t * sp = (uintptr_t *) (((uintptr_t) stack + size) & ~(uintptr_t) 15);
+    sp -= 20;
+    memset(sp, 0, 20 * sizeof(uintptr_t));
+    sp[11] = (uintptr_t) entry; // x30
+    ctx->sp = sp;
+}
+
+#else
+#error "no context switch for this architecture, build with -Dcontext=ucontext"
+#endif
+
+#ifndef WUT_CONTEXT_UCONTEXT
+void context_block_signal(context * ctx, int sig) {
+    (void) ctx;
+    (void) sig;
+}
+#endif
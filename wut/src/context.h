@@ -0,0 +1,39 @@
+#ifndef WUT_CONTEXT_H
+#define WUT_CONTEXT_H
+
+#include <stddef.h> // size_t
+
+/* Context
+ * A saved thread of execution. The default is a hand written switch that
+ * only saves the callee-saved registers on the thread's own stack, so
+ * `context` is just the saved stack pointer. Building with
+ * `-Dcontext=ucontext` (or on an architecture without a switch) falls back
+ * to `swapcontext`, which also saves the signal mask and FP state at the
+ * cost of a syscall per switch.
+ */
+#ifdef WUT_CONTEXT_UCONTEXT
+#include <ucontext.h> // ucontext_t
+typedef struct context {
+    ucontext_t uc;
+} context;
+#define CONTEXT_SAVES_SIGMASK 1
+#else
+typedef struct context {
+    void * sp;
+} context;
+#define CONTEXT_SAVES_SIGMASK 0
+#endif
+
+// Prepare `ctx` to call `entry` on the given stack the first time it's
+// switched to. `entry` must never return.
+void context_init(context * ctx, char * stack, size_t size, void (*entry)(void));
+
+// Save the current registers in `from` and resume `to`. A context that was
+// never initialised (like the main thread's) is filled in by its first switch.
+void context_switch(context * from, context * to);
+
+// Have `sig` blocked in the mask `ctx` is resumed with. Only matters with
+// CONTEXT_SAVES_SIGMASK, the other switches leave the mask alone.
+void context_block_signal(context * ctx, int sig);
+
+#endif
@@ -1,15 +1,31 @@
 #include "wut.h"
+#include "context.h"
 
 #include <assert.h> // assert
 #include <errno.h> // errno
+#include <fcntl.h> // fcntl
+#include <linux/futex.h> // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <poll.h> // poll
+#include <pthread.h> // pthread_create, pthread_getcpuclockid
+#include <signal.h> // sigaction
+#include <stdatomic.h> // atomic_*
+#include <stdbool.h> // bool
 #include <stddef.h> // NULL
+#include <stdint.h> // uint32_t, uint64_t
 #include <stdio.h> // perror
 #include <stdlib.h> // reallocarray
-#include <sys/mman.h> // mmap, munmap
-#include <sys/signal.h> // SIGSTKSZ
+#include <string.h> // memset
+#include <sys/epoll.h> // epoll_*
+#include <sys/eventfd.h> // eventfd
+#include <sys/mman.h> // mmap, mprotect, munmap
 #include <sys/queue.h> // TAILQ_*
-#include <ucontext.h> // getcontext, makecontext, setcontext, swapcontext
+#include <sys/syscall.h> // SYS_futex, SYS_gettid
+#include <time.h> // timer_create
+#include <unistd.h> // sysconf, syscall
 #include <valgrind/valgrind.h> // VALGRIND_STACK_REGISTER
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
 
 /* Declarations */
 #define DEBUG 0
@@ -18,6 +34,7 @@ void print_threads();
 void print_queue();
 typedef struct thread thread;
 typedef struct entry entry;
+typedef struct worker worker;
 
 static void die(const char* message) {
     int err = errno;
@@ -25,57 +42,383 @@ static void die(const char* message) {
     exit(err);
 }
 
+/* Lock */
+// Anything shared between workers is only held for a few instructions, so
+// a spinlock is enough. The holder can still lose its CPU to the kernel
+// though (there may be more workers than CPUs), so after a while we give
+// ours up instead of spinning out a whole time slice. With a single worker
+// nothing runs in parallel and locking is skipped.
+typedef struct spinlock{
+    atomic_bool held;
+} spinlock;
+
+#define SPIN_LIMIT 128
+
+static int workers_count = 1;
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// Gives the CPU to another kernel thread. This goes straight to the
+// system call, the pthread shim replaces sched_yield with wut_yield.
+static void kernel_yield(void) {
+    syscall(SYS_sched_yield);
+}
+
+static void spin_lock(spinlock* lock) {
+    if (workers_count == 1) return;
+    while (atomic_exchange_explicit(&lock->held, true, memory_order_acquire)) {
+        for (int spins = 0; atomic_load_explicit(&lock->held, memory_order_relaxed); spins++) {
+            if (spins < SPIN_LIMIT) cpu_relax();
+            else kernel_yield();
+        }
+    }
+}
+
+static void spin_unlock(spinlock* lock) {
+    if (workers_count == 1) return;
+    atomic_store_explicit(&lock->held, false, memory_order_release);
+}
+
+// Protects the thread table, free IDs and join/cancel/exit state
+static spinlock wut_lock;
+// Protects the stack and TCB caches
+static spinlock cache_lock;
+
 /* Stack */
-static char* new_stack(void) {
-    char* stack = mmap(
+// Stacks are reserved with MAP_NORESERVE, so the kernel only commits (and
+// counts towards RSS) the pages a thread actually touches. Below each stack
+// is an optional PROT_NONE guard, an overflow faults there instead of
+// silently writing over whatever was mapped below. Note every guarded (or
+// growable, see Stack Growth) stack takes two memory mappings, so more than
+// ~30k such threads needs a larger vm.max_map_count.
+#define STACK_SIZE_DEFAULT (64 * 1024)
+#define STACK_SIZE_MIN_SHIFT 14 // 16 KiB
+#define STACK_CLASSES 48
+
+typedef struct stack{
+    char * base; // start of the mapping, the guard is first
+    size_t size; // usable bytes, always a power of two
+    size_t guard;
+    bool growable; // only the part from `low` up is accessible
+    char * low;
+} stack;
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (size == 0) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// Stacks are sized in powers of two, so similar requests share a cache
+static size_t stack_round_size(size_t size) {
+    size_t rounded = (size_t) 1 << STACK_SIZE_MIN_SHIFT;
+    while (rounded < size && rounded != 0) rounded <<= 1;
+    return rounded;
+}
+
+static size_t stack_round_guard(size_t guard) {
+    size_t page = page_size();
+    return (guard + page - 1) / page * page;
+}
+
+static char* stack_top(stack* st) {
+    return st->base + st->guard + st->size;
+}
+
+// A growable stack is mapped PROT_NONE, guard included, and only its top
+// page is made accessible
+static int new_stack(stack* st, size_t size, size_t guard, bool growable) {
+    st->size = size;
+    st->guard = guard;
+    st->growable = growable;
+    st->base = mmap(
         NULL,
-        SIGSTKSZ,
-        PROT_READ | PROT_WRITE | PROT_EXEC,
-        MAP_ANONYMOUS | MAP_PRIVATE,
+        guard + size,
+        growable ? PROT_NONE : PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_STACK,
         -1,
         0
     );
-    if (stack == MAP_FAILED) {
-        die("mmap stack failed");
+    if (st->base == MAP_FAILED) {
+        st->base = NULL;
+        return -1;
     }
-    VALGRIND_STACK_REGISTER(stack, stack + SIGSTKSZ);
-    return stack;
+    int err = 0;
+    if (growable) {
+        st->low = stack_top(st) - page_size();
+        err = mprotect(st->low, page_size(), PROT_READ | PROT_WRITE);
+    }
+    else if (guard > 0) {
+        err = mprotect(st->base, guard, PROT_NONE);
+    }
+    if (err == -1) {
+        munmap(st->base, guard + size);
+        st->base = NULL;
+        return -1;
+    }
+    VALGRIND_STACK_REGISTER(st->base + guard, stack_top(st));
+    return 0;
 }
 
-static void delete_stack(char* stack) {
-    if (munmap(stack, SIGSTKSZ) == -1) {
+static void delete_stack(stack* st) {
+    if (munmap(st->base, st->guard + st->size) == -1) {
         die("munmap stack failed");
     }
+    st->base = NULL;
+}
+
+/* Cache */
+// Stacks and TCBs of finished threads are kept on free lists and handed to
+// the next wut_create, so spawning in steady state costs no mmap or malloc.
+// Each list holds at most `cache_limit` items, anything beyond that is
+// given back to the system.
+#define CACHE_LIMIT_DEFAULT 64
+static int cache_limit = CACHE_LIMIT_DEFAULT;
+
+// A cached stack keeps its own description and the next cached stack of the
+// same size at the top of its memory (the page a thread touches first
+// anyway). There's one list per size.
+typedef struct cached_stack{
+    struct cached_stack * next;
+    stack st;
+} cached_stack;
+
+static cached_stack* stack_cache[STACK_CLASSES];
+static int stack_cache_count = 0;
+
+static int stack_class(size_t size) {
+    return __builtin_ctzl(size) - STACK_SIZE_MIN_SHIFT;
+}
+
+// Only the head of the list is checked, a cached stack with a different
+// guard (or growable when this one isn't) is left for a later request
+// rather than searched past. A growable stack always has a guard, running
+// into it is how an overflow is told apart from growing.
+static int get_stack(stack* st, size_t size, size_t guard, bool growable) {
+    size = stack_round_size(size);
+    guard = stack_round_guard(guard);
+    if (growable && guard == 0) guard = page_size();
+    if (size == 0 || stack_class(size) >= STACK_CLASSES) return -1;
+    spin_lock(&cache_lock);
+    cached_stack* cached = stack_cache[stack_class(size)];
+    if (cached == NULL || cached->st.guard != guard || cached->st.growable != growable) {
+        spin_unlock(&cache_lock);
+        return new_stack(st, size, guard, growable);
+    }
+    stack_cache[stack_class(size)] = cached->next;
+    stack_cache_count--;
+    spin_unlock(&cache_lock);
+    *st = cached->st;
+    return 0;
+}
+
+static void put_stack(stack* st) {
+    spin_lock(&cache_lock);
+    if (stack_cache_count >= cache_limit) {
+        spin_unlock(&cache_lock);
+        delete_stack(st);
+        return;
+    }
+    cached_stack* cached = (cached_stack*) (stack_top(st) - sizeof(cached_stack));
+    cached->st = *st;
+    cached->next = stack_cache[stack_class(st->size)];
+    stack_cache[stack_class(st->size)] = cached;
+    stack_cache_count++;
+    spin_unlock(&cache_lock);
+    st->base = NULL;
+}
+
+/* Stack Usage */
+// A stack grows down and its pages stay committed once touched, so the
+// lowest committed page shows how deep the stack ever went. mincore tells
+// which pages are committed (one that got swapped out would be missed).
+static atomic_bool stack_usage;
+static int stack_usage_fd = -1;
+static atomic_ulong stack_usage_threads;
+static atomic_size_t stack_usage_max;
+static atomic_ulong stack_usage_buckets[WUT_STACK_BUCKETS];
+
+static size_t stack_used(stack* st) {
+    size_t page = page_size();
+    char* bottom = st->base + st->guard;
+    size_t pages = st->size / page;
+    unsigned char vec[256];
+    for (size_t first = 0; first < pages; first += sizeof(vec)) {
+        size_t count = pages - first < sizeof(vec) ? pages - first : sizeof(vec);
+        if (mincore(bottom + first * page, count * page, vec) == -1) return 0;
+        for (size_t i = 0; i < count; i++) {
+            if (vec[i] & 1) return (pages - first - i) * page;
+        }
+    }
+    return 0;
+}
+
+// Called when a thread's stack is retired. The stack is emptied so whoever
+// gets it from the cache next starts from nothing.
+static size_t stack_usage_record(int id, stack* st) {
+    size_t used = stack_used(st);
+    int bucket = 0;
+    while (bucket < WUT_STACK_BUCKETS - 1 && used > ((size_t) 4096 << bucket)) bucket++;
+    atomic_fetch_add_explicit(&stack_usage_buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stack_usage_threads, 1, memory_order_relaxed);
+    size_t max = atomic_load_explicit(&stack_usage_max, memory_order_relaxed);
+    while (used > max && !atomic_compare_exchange_weak(&stack_usage_max, &max, used));
+    if (stack_usage_fd >= 0) {
+        dprintf(stack_usage_fd, "thread %d used %zu of %zu stack bytes\n", id, used, st->size);
+    }
+    madvise(st->base + st->guard, st->size, MADV_DONTNEED);
+    return used;
 }
 
 /* Thread */
+// Threads waiting for something, in the order they started waiting
+typedef struct waitq{
+    thread * head;
+    thread * tail;
+} waitq;
+
 typedef struct thread{
     int id;
-    int block_id; // the thread ID that is blocked by this thread
-    int state; // -1 is alive, -2 is blocked, 0~255 is exited
-    char * stack;
+    waitq joiners; // threads blocked joining this one
+    int join_refs; // joiners that haven't collected the exit status yet
+    int join_id; // the thread ID this thread is blocked on
+    struct group * group; // reaps this thread instead of wut_join
+    int priority; // set by wut_set_priority
+    int level; // the level it's queued at, the MLFQ moves it from priority
+    // Accounting while tracing, in trace_clock ticks
+    uint64_t run_start; // when it last started running
+    uint64_t queued_at; // when it last became runnable
+    uint64_t cpu_ticks;
+    uint64_t runnable_ticks;
+    unsigned long run_count; // times it was switched to
+    int state; // -1 is alive, -2 is blocked, -3 waits for I/O, -4 sleeps, -5 waits on a lock, -6 waits on channels, 0~255 is exited
+    atomic_bool cancel_pending; // cancelled while running on another worker
+    worker * _Atomic queue; // the run queue holding this thread, if any
+    int preempt_off; // preemption is held off while > 0
+    int io_fd; // the fd it waits on while state is -3
+    uint32_t io_events; // what the reactor saw on io_fd
+    uint64_t expires; // tick its timer fires at, if timer_armed
+    int timer_level, timer_slot; // where it is in the wheel
+    bool timer_armed;
+    bool timed_out; // woken by its timer rather than what it waited for
+    LIST_ENTRY(thread) timer_entries;
+    struct waitq * waiting_on; // the wait queue it's in while state is -2 or -5
+    struct thread * next_wait;
+    int wait_mode; // what it waits for, for wait queues that care
+    struct mutex * wait_mutex; // the mutex to take back after a cond wait
+    struct chan_wait * chan_wait; // what it selects on while state is -6
+    long stack_peak; // measured when it exited, -1 if stack usage wasn't on
+    void * specific[WUT_KEYS_MAX]; // wut_setspecific values, NULL in a cached TCB
+    stack stack;
     entry * ent;
-    ucontext_t context;
-    ucontext_t * ctx_ptr;
+    struct thread * next_free; // next TCB in thread_cache
+    void (*run)(void);
+    void (*run_arg)(void *); // for wut_create_arg, `run` calls it with `arg`
+    void * arg;
+    context context;
+    context * ctx_ptr;
 } thread;
 
 /* Queue */
 typedef struct entry{
     thread * val;
+    int level; // the run queue it's in
     TAILQ_ENTRY(entry) entries;
 } entry;
 
+TAILQ_HEAD(head, entry);
+
+// Run queues are per priority level, 0 runs first. Threads with the same
+// level run in FIFO order.
+#define PRIORITY_LEVELS WUT_PRIORITY_LEVELS
+#define PRIORITY_LOWEST (PRIORITY_LEVELS - 1)
+_Static_assert(PRIORITY_LEVELS <= 32, "the run queue bitmap is 32 bits");
+
+static int sched_policy = WUT_SCHED_PRIORITY;
+
+/* Worker */
+// Every worker is a kernel thread with its own run queue, worker 0 is the
+// one that called wut_init. The thread a worker is running is not in any
+// queue. A worker that runs out of threads switches to its idle thread,
+// which steals from the other queues or sleeps until something is queued.
+typedef struct worker{
+    int index;
+    spinlock lock; // protects runq and runq_bitmap
+    uint32_t runq_bitmap; // levels with a thread in their queue
+    struct head runq[PRIORITY_LEVELS];
+    thread * current;
+    thread * idle;
+    // What's left to do for the thread we switched away from, it can only
+    // be done once we're off its stack (see finish_switch)
+    thread * prev;
+    bool requeue_prev; // it yielded, put it back on the run queue
+    bool retire_prev; // it exited, release its stack
+    bool unlock_prev; // it held wut_lock across the switch
+    // Preemption, see wut_set_quantum
+    pthread_t pthread;
+    atomic_int tid;
+    timer_t timer;
+    bool has_timer;
+    unsigned long switches;
+    unsigned long tick_switches; // `switches` at the last tick
+    bool preempt_pending; // a tick came while preemption was held off
+    bool preempt_blocked; // the tick is blocked, for a growable stack
+    // Tracing, see wut_trace_start
+    struct trace_event * trace;
+    uint64_t trace_next; // events recorded, the ring keeps the newest
+} worker;
+
+static worker * workers;
+
+// Threads that are running or in a run queue. When this drops to zero
+// nothing can ever run again, so the process exits.
+static atomic_int runnable;
+
+// Idle workers sleep on `wake_seq`, anyone queueing a thread bumps it
+static atomic_int idle_workers;
+static atomic_uint wake_seq;
+
+// The worker blocked in epoll_wait (if any) is woken through an eventfd
+static atomic_bool reactor_sleeping;
+static int reactor_wake_fd = -1;
+
+static _Thread_local worker * current_worker __attribute__((tls_model("initial-exec")));
+
+// Threads move between workers, so the worker has to be looked up again
+// after every switch. The barrier stops the compiler from reusing an
+// earlier lookup. initial-exec keeps the lookup a single load, it's on
+// every switch.
+static __attribute__((noinline)) worker * this_worker(void) {
+    __asm__ volatile("" ::: "memory");
+    return current_worker;
+}
+
+// The thread running on this worker. `this_worker()->current` is two loads,
+// and a preemption between them can move the thread to another worker, so
+// that it reads somebody else's thread. This is kept up to date on every
+// switch, and this_thread() reads it in a single load, which a signal
+// can't land in the middle of.
+static _Thread_local thread * current_thread __attribute__((tls_model("initial-exec")));
+
+static __attribute__((noinline)) thread * this_thread(void) {
+    __asm__ volatile("" ::: "memory");
+    return current_thread;
+}
+
 /* Thread Pool */
 thread ** threads;
 int threads_count;
 int threads_capacity;
 
-/* Ready Queue */
-TAILQ_HEAD(head, entry);
-static struct head ready_queue;
-
-/* Thread Scheduler */
-ucontext_t scheduler, * scheduler_ptr = &scheduler;
+/* TCB Cache */
+static thread * thread_cache = NULL;
+static int thread_cache_count = 0;
 
 /* Helper Functions P1. Threads Pool */
 void threads_expand(){
@@ -89,269 +432,2557 @@ void threads_expand(){
     threads_capacity = new_capacity;
 }
 
-int min_available_id(){
-    for(int i = 0; i < threads_capacity; i++){
-        if(threads[i] == NULL) return i;
+/* Free IDs */
+// IDs that have never been handed out start at `next_id`. IDs below it that
+// were freed by wut_join go in a min-heap, so the lowest free ID is always
+// either the top of the heap or `next_id`.
+static int * free_ids = NULL;
+static int free_ids_count = 0;
+static int free_ids_capacity = 0;
+static int next_id = 0;
+
+static void free_ids_push(int id){
+    if(free_ids_count == free_ids_capacity){
+        free_ids_capacity = free_ids_capacity == 0 ? 16 : free_ids_capacity * 2;
+        free_ids = (int*) realloc(free_ids, free_ids_capacity * sizeof(int));
+        if(free_ids == NULL) die("free ids re-alloc");
+    }
+    int i = free_ids_count++;
+    while(i > 0 && free_ids[(i - 1) / 2] > id){
+        free_ids[i] = free_ids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    free_ids[i] = id;
+}
+
+static int free_ids_pop(){
+    int min = free_ids[0];
+    int last = free_ids[--free_ids_count];
+    int i = 0;
+    while(2 * i + 1 < free_ids_count){
+        int child = 2 * i + 1;
+        if(child + 1 < free_ids_count && free_ids[child + 1] < free_ids[child]) child++;
+        if(free_ids[child] >= last) break;
+        free_ids[i] = free_ids[child];
+        i = child;
     }
-    return -1;
+    free_ids[i] = last;
+    return min;
+}
+
+int min_available_id(){
+    if(free_ids_count > 0) return free_ids_pop();
+    return next_id++;
 }
 
 void print_threads(){
     printf("Current Threads TCB Array\n");
     for(int i = 0; i < threads_capacity; i++){
         if(threads[i] != NULL)
-            printf("%dth thread ID: %d, block ID: %d, status: %d\n", i, threads[i]->id, threads[i]->block_id, threads[i]->state);
+            printf("%dth thread ID: %d, joiners: %d, status: %d\n", i, threads[i]->id, threads[i]->join_refs, threads[i]->state);
     }
 }
 
-/* Helper Functions P2. Thread */
-thread * create_thread(void (*run)(void)){
-    threads_count++;
+/* Tracing */
+// While tracing, every worker records scheduler events into its own ring
+// buffer (so no locking), and threads keep count of where their time goes.
+// Timestamps are TSC ticks, converted with a rate measured between
+// wut_trace_start and whenever the ticks are read back. With tracing off
+// the only cost is a branch at each hook.
+#define TRACE_CREATE 0
+#define TRACE_SWITCH 1 // `id` stops running, `other` starts
+#define TRACE_WAKE 2 // `other` woke `id` up
 
-    thread * new = (thread*) malloc(sizeof (thread));
-    if(new == NULL) die("create new thread malloc");
+typedef struct trace_event{
+    uint64_t time;
+    int type;
+    int id;
+    int other;
+    int state; // for switches, the state `id` was left in
+} trace_event;
 
-    int id = min_available_id();
-    if(id < 0) die("no available thread");
+static bool tracing;
+static size_t trace_size; // events per worker, a power of two
+static uint64_t trace_start_ticks;
+static uint64_t trace_start_ns;
 
-    new->id = id;
-    new->block_id = -1;
-    new->state = -1;
-    new->stack = new_stack();
+static uint64_t trace_clock(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
 
-    new->ctx_ptr = &(new->context);
-    getcontext(new->ctx_ptr);
-    new->ctx_ptr->uc_stack.ss_sp = new->stack;
-    new->ctx_ptr->uc_stack.ss_size = SIGSTKSZ;
-    new->ctx_ptr->uc_stack.ss_flags = 0;
-    new->ctx_ptr->uc_link = scheduler_ptr;
-    if(run != NULL) makecontext(new->ctx_ptr, (void(*)()) run, 0);
+static double trace_ticks_per_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    uint64_t ticks = trace_clock();
+    if(ns <= trace_start_ns || ticks <= trace_start_ticks) return 1.0;
+    return (double) (ticks - trace_start_ticks) / (ns - trace_start_ns);
+}
 
-    return new;
+static void trace_record(worker * w, int type, int id, int other, int state){
+    if(w->trace == NULL) return;
+    trace_event * ev = &w->trace[w->trace_next & (trace_size - 1)];
+    ev->time = trace_clock();
+    ev->type = type;
+    ev->id = id;
+    ev->other = other;
+    ev->state = state;
+    w->trace_next++;
 }
 
-void delete_thread(thread * th){
-//    delete_stack(th->stack);
-//    th->ctx_ptr->uc_stack.ss_sp = NULL;
-//    th->ctx_ptr->uc_stack.ss_size = 0;
-    th->ctx_ptr->uc_stack.ss_flags = 0;
-    th->ctx_ptr->uc_link = NULL;
-    th->ent = NULL;
-//    free(th->ctx_ptr);
-//    free(th);
+// Called from switch_to, the idle thread isn't accounted for
+static void trace_switch(worker * w, thread * prev, thread * next){
+    uint64_t now = trace_clock();
+    // A thread already running when tracing started is counted from then
+    if(prev != w->idle && prev->run_start >= trace_start_ticks) prev->cpu_ticks += now - prev->run_start;
+    else if(prev != w->idle) prev->cpu_ticks += now - trace_start_ticks;
+    if(next != w->idle){
+        next->run_start = now;
+        next->run_count++;
+        if(next->queued_at != 0) next->runnable_ticks += now - next->queued_at;
+        next->queued_at = 0;
+    }
+    trace_record(w, TRACE_SWITCH, prev->id, next->id, prev->state);
+}
+
+static const char * trace_state_name(int state){
+    switch(state){
+        case -1: return "yield";
+        case -2: return "join";
+        case -3: return "io";
+        case -4: return "sleep";
+        case -5: return "lock";
+        case -6: return "channel";
+        default: return "exit";
+    }
+}
+
+/* Helper Functions P2. Queue */
+static void futex_wait(atomic_uint * addr, unsigned value){
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint * addr, int count){
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static void enqueue(worker * w, thread * th){
+    if(tracing) th->queued_at = trace_clock();
+    entry * en = th->ent;
+    en->level = th->level;
+    spin_lock(&w->lock);
+    TAILQ_INSERT_TAIL(&w->runq[en->level], en, entries);
+    w->runq_bitmap |= 1u << en->level;
+    atomic_store_explicit(&th->queue, w, memory_order_relaxed);
+    spin_unlock(&w->lock);
+
+    if(workers_count == 1) return;
+    // Pairs with the fence in park(), either we see the idle worker or it
+    // sees our thread
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&idle_workers, memory_order_relaxed) > 0){
+        atomic_fetch_add(&wake_seq, 1);
+        futex_wake(&wake_seq, 1);
+    }
+    else if(atomic_load_explicit(&reactor_sleeping, memory_order_relaxed)){
+        uint64_t one = 1;
+        ssize_t ignored = write(reactor_wake_fd, &one, sizeof one);
+        (void) ignored;
+    }
+}
+
+static void runq_remove(worker * w, entry * en){
+    TAILQ_REMOVE(&w->runq[en->level], en, entries);
+    if(TAILQ_EMPTY(&w->runq[en->level])) w->runq_bitmap &= ~(1u << en->level);
+    atomic_store_explicit(&en->val->queue, NULL, memory_order_relaxed);
+}
+
+// The first thread of the most urgent level, as long as that's no lower
+// than `max_level`
+static thread * dequeue_upto(worker * w, int max_level){
+    spin_lock(&w->lock);
+    entry * en = NULL;
+    if(w->runq_bitmap != 0){
+        int level = __builtin_ctz(w->runq_bitmap);
+        if(level <= max_level){
+            en = TAILQ_FIRST(&w->runq[level]);
+            runq_remove(w, en);
+        }
+    }
+    spin_unlock(&w->lock);
+    return en == NULL ? NULL : en->val;
+}
+
+static thread * dequeue(worker * w){
+    return dequeue_upto(w, PRIORITY_LOWEST);
+}
+
+// Take a particular thread off whichever queue it's on. Fails if it isn't
+// queued, i.e. it's running (or about to) somewhere.
+static bool dequeue_thread(thread * th){
+    worker * w = atomic_load_explicit(&th->queue, memory_order_relaxed);
+    if(w == NULL) return false;
+    spin_lock(&w->lock);
+    bool queued = atomic_load_explicit(&th->queue, memory_order_relaxed) == w;
+    if(queued) runq_remove(w, th->ent);
+    spin_unlock(&w->lock);
+    return queued;
+}
+
+static bool any_work(void){
+    for(int i = 0; i < workers_count; i++){
+        spin_lock(&workers[i].lock);
+        bool empty = workers[i].runq_bitmap == 0;
+        spin_unlock(&workers[i].lock);
+        if(!empty) return true;
+    }
+    return false;
+}
+
+static void park(void){
+    unsigned seq = atomic_load(&wake_seq);
+    atomic_fetch_add(&idle_workers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(!any_work()) futex_wait(&wake_seq, seq);
+    atomic_fetch_sub(&idle_workers, 1);
+}
+
+static atomic_int io_waiters;
+static atomic_int timers_armed;
+static bool timers_run(worker * w);
+static bool reactor_wait(worker * w);
+
+// Our own queue first, then steal the oldest thread of another worker. With
+// nothing to steal, one idle worker waits for I/O or the next timer, the
+// others sleep.
+static thread * find_work(worker * w){
+    while(1){
+        thread * next = dequeue(w);
+        for(int i = 1; next == NULL && i < workers_count; i++){
+            next = dequeue(&workers[(w->index + i) % workers_count]);
+        }
+        if(next != NULL) return next;
+        if(timers_run(w)) continue;
+        if((atomic_load(&io_waiters) > 0 || atomic_load(&timers_armed) > 0) && reactor_wait(w)) continue;
+        park();
+    }
 }
 
-/* Helper Functions P3. Queue */
 entry * create_entry(thread * th){
-    entry * en = (entry*) malloc(sizeof (entry));
+    // A recycled TCB still has its entry
+    entry * en = th->ent;
+    if(en == NULL) en = (entry*) malloc(sizeof (entry));
     if(en == NULL) die("create new entry malloc");
     en->val = th;
     th->ent = en;
-    TAILQ_INSERT_TAIL(&ready_queue, en, entries);
     return en;
 }
 
 void print_queue(){
+    worker * w = this_worker();
     entry * curr = NULL;
     int counter = 0;
     printf("Current Ready Queue\n");
-    TAILQ_FOREACH(curr, &ready_queue, entries){
-        printf("%dth entry, thread ID: %d, block ID: %d, status: %d\n", counter, curr->val->id, curr->val->block_id, curr->val->state);
-        counter++;
+    printf("running thread ID: %d\n", w->current->id);
+    for(int level = 0; level < PRIORITY_LEVELS; level++){
+        TAILQ_FOREACH(curr, &w->runq[level], entries){
+            printf("%dth entry, thread ID: %d, level: %d, status: %d\n", counter, curr->val->id, level, curr->val->state);
+            counter++;
+        }
     }
 }
 
-void schedule(){
-    getcontext(scheduler_ptr);
+/* Helper Functions P3. Thread */
+static pthread_once_t growth_once = PTHREAD_ONCE_INIT;
+static bool growth_used = false; // a growable stack was ever created
+static void growth_install(void);
+static void growth_init_worker(void);
+static void finish_switch(void);
+static void preempt_enable(thread * self);
+static void preempt_yield(thread * self);
+static void preempt_block(worker * w, bool blocked);
+static void preempt_hold(worker * w, thread * next);
 
-    if(TAILQ_EMPTY(&ready_queue)) exit(0);
-    entry * head = TAILQ_FIRST(&ready_queue);
+// Every new thread starts here, on its own stack. Returning from `run` is
+// the same as calling `wut_exit(0)`.
+static void thread_entry(void){
+    finish_switch();
+    thread * self = this_thread();
+    preempt_enable(self);
+    self->run();
+    wut_exit(0);
+}
 
-    if(head->val->state < 0) wut_exit(0);
+static thread * get_tcb(){
+    spin_lock(&cache_lock);
+    thread * th = thread_cache;
+    if(th != NULL){
+        thread_cache = th->next_free;
+        thread_cache_count--;
+    }
+    spin_unlock(&cache_lock);
+    if(th == NULL){
+        th = (thread*) malloc(sizeof (thread));
+        if(th == NULL) die("create new thread malloc");
+        th->ent = NULL;
+        memset(th->specific, 0, sizeof th->specific);
+    }
+    return th;
+}
 
-    if(DEBUG){
-        printf("\nEnter Scheduler\n");
-        print_threads();
-        print_queue();
+// The new thread has no ID yet, see register_thread
+thread * create_thread(void (*run)(void), const wut_attr * attr){
+    // The main thread keeps running on the process stack
+    stack st = { NULL, 0, 0, false, NULL };
+    if(run != NULL && get_stack(&st, attr->stack_size, attr->guard_size, attr->growable) < 0){
+        return NULL;
     }
+    if(run != NULL && attr->growable) pthread_once(&growth_once, growth_install);
 
-    if(head->val->block_id >= 0){
-        int wake_id = head->val->block_id;
-        TAILQ_INSERT_TAIL(&ready_queue, threads[wake_id]->ent, entries);
-        threads[wake_id]->state = -1;
-        if(DEBUG){
-            printf("\nWake Thread %d\n", wake_id);
-            print_threads();
-            print_queue();
-        }
+    thread * new = get_tcb();
+    new->id = -1;
+    new->joiners = (waitq){ NULL, NULL };
+    new->join_refs = 0;
+    new->join_id = -1;
+    new->group = (struct group*) attr->group;
+    new->priority = attr->priority;
+    new->level = attr->priority;
+    new->queued_at = 0;
+    new->cpu_ticks = 0;
+    new->runnable_ticks = 0;
+    new->run_count = 0;
+    new->state = -1;
+    atomic_init(&new->cancel_pending, false);
+    atomic_init(&new->queue, NULL);
+    new->timer_armed = false;
+    new->timed_out = false;
+    new->waiting_on = NULL;
+    new->stack_peak = -1;
+    // A new thread starts out in the middle of a switch
+    new->preempt_off = run == NULL ? 0 : 1;
+    new->run = run;
+    new->ctx_ptr = &(new->context);
+    new->stack = st;
+    create_entry(new);
+    if(run != NULL){
+        context_init(new->ctx_ptr, new->stack.base + new->stack.guard, new->stack.size, thread_entry);
     }
 
-    delete_thread(head->val);
-    TAILQ_REMOVE(&ready_queue, head, entries);
+    return new;
+}
 
-    if(TAILQ_EMPTY(&ready_queue)) exit(0);
-    head = TAILQ_FIRST(&ready_queue);
+// Called with wut_lock held
+static void register_thread(thread * th){
+    int id = min_available_id();
+    while(id >= threads_capacity) threads_expand();
+    th->id = id;
+    threads[id] = th;
+    threads_count++;
+}
 
-    if(DEBUG){
-        printf("\nSchedule Thread %d To Run\n", head->val->id);
-        print_threads();
-        print_queue();
+// The thread won't run again, so its stack can go. The TCB stays until
+// someone joins the thread, it still holds the exit status.
+void delete_thread(thread * th){
+    if(th->stack.base != NULL){
+        if(atomic_load_explicit(&stack_usage, memory_order_relaxed)){
+            th->stack_peak = stack_usage_record(th->id, &th->stack);
+        }
+        put_stack(&th->stack);
     }
-
-    setcontext(head->val->ctx_ptr);
-    delete_thread(head->val);
 }
 
-/* Library Functions */
-void wut_init() {
-    /* Threads Pool */
-    threads_count = 0;
-    threads_capacity = 10;
-    threads = (thread**) malloc(threads_capacity * sizeof (thread*));
-    if(threads == NULL) die("threads malloc");
-    for(int i = 0; i < threads_capacity; i++){
-        threads[i] = NULL;
+// Called once the exit status has been collected, the ID becomes free.
+// Called with wut_lock held.
+void free_thread(thread * th){
+    threads[th->id] = NULL;
+    threads_count--;
+    free_ids_push(th->id);
+    spin_lock(&cache_lock);
+    if(thread_cache_count >= cache_limit){
+        spin_unlock(&cache_lock);
+        free(th->ent);
+        free(th);
+        return;
     }
+    th->next_free = thread_cache;
+    thread_cache = th;
+    thread_cache_count++;
+    spin_unlock(&cache_lock);
+}
 
-    /* Scheduler */
-    if(getcontext(scheduler_ptr) < 0) die("scheduler get context");
-    scheduler_ptr->uc_stack.ss_sp = new_stack();
-    scheduler_ptr->uc_stack.ss_size = SIGSTKSZ;
-    scheduler_ptr->uc_stack.ss_flags = 0;
-    scheduler_ptr->uc_link = NULL;
-    makecontext(scheduler_ptr, (void(*)()) schedule, 0);
+static void timer_remove(thread * th);
+static void group_exited(struct group * g, thread * th);
 
-    /* Main Thread */
-    thread * main_thread = create_thread(NULL);
-    threads[main_thread->id] = main_thread;
+static void waitq_push(waitq * q, thread * th, int mode){
+    th->waiting_on = q;
+    th->wait_mode = mode;
+    th->next_wait = NULL;
+    if(q->tail == NULL) q->head = th;
+    else q->tail->next_wait = th;
+    q->tail = th;
+}
 
-    /* Queue */
-    TAILQ_INIT(&ready_queue);
-    create_entry(main_thread);
+static thread * waitq_pop(waitq * q){
+    thread * th = q->head;
+    if(th == NULL) return NULL;
+    q->head = th->next_wait;
+    if(q->head == NULL) q->tail = NULL;
+    th->waiting_on = NULL;
+    return th;
+}
 
-    if(DEBUG){
-        printf("Initial Thread %d\n", main_thread->id);
-        print_threads();
-        print_queue();
+// Only for cancels and timeouts, so a walk is fine
+static void waitq_remove(waitq * q, thread * th){
+    thread ** link = &q->head;
+    thread * prev = NULL;
+    while(*link != th){
+        prev = *link;
+        link = &(*link)->next_wait;
     }
+    *link = th->next_wait;
+    if(q->tail == th) q->tail = prev;
+    th->waiting_on = NULL;
 }
 
-int wut_id() {
-    entry * head = TAILQ_FIRST(&ready_queue);
-    return head->val->id;
+// Called with wut_lock held, `th` gives up joining
+static void join_forget(thread * th){
+    threads[th->join_id]->join_refs--;
+    waitq_remove(th->waiting_on, th);
 }
 
-int wut_create(void (*run)(void)) {
-    if(threads_count >= threads_capacity) threads_expand();
-    thread * new_thread = create_thread(run);
-    threads[new_thread->id] = new_thread;
-    create_entry(new_thread);
+// Called with wut_lock held, the woken thread goes on our queue
+static void wake_thread(worker * w, thread * th){
+    if(th->timer_armed) timer_remove(th);
+    // It blocked before using up its quantum, so it's back at its own level
+    th->level = th->priority;
+    if(tracing) trace_record(this_worker(), TRACE_WAKE, th->id, this_thread()->id, 0);
+    th->state = -1;
+    th->join_id = -1;
+    atomic_fetch_add(&runnable, 1);
+    enqueue(w, th);
+}
 
-    if(DEBUG){
-        printf("\nCreate new thread %d\n", new_thread->id);
-        print_threads();
-        print_queue();
+// The calling thread stopped being runnable. If it was the last one and
+// nobody waits for I/O or a timer, no one is left to wake anybody up.
+static void leave_runnable(void){
+    if(atomic_fetch_sub(&runnable, 1) == 1 && atomic_load(&io_waiters) == 0 && atomic_load(&timers_armed) == 0) exit(0);
+}
+
+// Called with wut_lock held once `th` has its exit status. Every joiner
+// wakes up, the last one to collect the status frees the TCB.
+static void thread_exited(worker * w, thread * th){
+    thread * joiner;
+    while((joiner = waitq_pop(&th->joiners)) != NULL){
+        wake_thread(w, joiner);
     }
+    if(th->group != NULL) group_exited(th->group, th);
+}
 
-    return new_thread->id;
+/* Helper Functions P4. Switch */
+static void switch_to(worker * w, thread * next){
+    thread * prev = w->current;
+    if(tracing) trace_switch(w, prev, next);
+    w->prev = prev;
+    w->current = next;
+    current_thread = next;
+    w->switches++;
+    w->preempt_pending = false;
+    if(prev->stack.growable || next->stack.growable) preempt_hold(w, next);
+    context_switch(prev->ctx_ptr, next->ctx_ptr);
+    finish_switch();
 }
 
-int wut_cancel(int id) {
-    entry * head = TAILQ_FIRST(&ready_queue);
-    if(id < 0 || id > threads_capacity || threads[id] == NULL || head->val->id == id) return -1;
+// Runs first thing on the thread we switched to. Until now the previous
+// thread was still on its own stack, so other workers mustn't see it in a
+// queue, free its stack, or (through wut_lock) wake it up.
+static void finish_switch(void){
+    worker * w = this_worker();
+    if(w->requeue_prev){
+        w->requeue_prev = false;
+        enqueue(w, w->prev);
+    }
+    if(w->retire_prev){
+        w->retire_prev = false;
+        delete_thread(w->prev);
+    }
+    if(w->unlock_prev){
+        w->unlock_prev = false;
+        spin_unlock(&wut_lock);
+    }
+    // Only a growable thread runs with the tick blocked. A switch that
+    // restores the signal mask can bring back any mask at all.
+    bool blocked = w->current->stack.growable;
+    if(blocked != w->preempt_blocked || (CONTEXT_SAVES_SIGMASK && growth_used)){
+        preempt_block(w, blocked);
+    }
+}
 
-    entry * curr = NULL;
-    TAILQ_FOREACH(curr, &ready_queue, entries){
-        if(curr->val->block_id == id){
-            curr->val->block_id = -1;
-            break;
+static thread * pick_next(worker * w){
+    thread * next = dequeue(w);
+    return next == NULL ? w->idle : next;
+}
+
+// A thread cancelled while it was running exits at its next yield or join
+static void check_cancel(thread * self){
+    if(atomic_load_explicit(&self->cancel_pending, memory_order_relaxed)){
+        wut_exit(128);
+    }
+}
+
+// Every worker's idle thread, a worker switches here when it has nothing
+// left to run.
+static void schedule(void){
+    finish_switch();
+    while(1){
+        worker * w = this_worker();
+
+        if(DEBUG){
+            printf("\nEnter Scheduler\n");
+            print_threads();
+            print_queue();
+        }
+
+        thread * next = find_work(w);
+
+        if(DEBUG){
+            printf("\nSchedule Thread %d To Run\n", next->id);
         }
+
+        switch_to(w, next);
     }
+}
+
+static void* worker_main(void * arg){
+    worker * w = (worker*) arg;
+    current_worker = w;
+    growth_init_worker();
+    atomic_store(&w->tid, syscall(SYS_gettid));
+    // The idle thread of this worker is the kernel thread itself
+    w->current = w->idle;
+    current_thread = w->idle;
+    w->prev = w->idle;
+    schedule();
+    return NULL;
+}
+
+/* Preemption */
+// With a quantum set, each worker gets a timer on its own CPU clock, so it
+// only ticks while the worker is busy. A thread that was running through a
+// whole tick interval is made to yield from the signal handler. Inside wut
+// (or between wut_preempt_disable/enable) the tick is only noted, and the
+// thread yields once preemption is allowed again.
+#define PREEMPT_SIGNAL SIGURG // ignored by default, a stray one is harmless
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static long preempt_quantum = 0; // usec, 0 is off
+static bool preempt_installed = false;
+
+static void preempt_disable(thread * self){
+    self->preempt_off++;
+    atomic_signal_fence(memory_order_seq_cst);
+}
 
-    if(threads[id]->block_id >= 0){
-        int wake_id = threads[id]->block_id;
-        TAILQ_INSERT_TAIL(&ready_queue, threads[wake_id]->ent, entries);
-        threads[wake_id]->state = -1;
+static void preempt_enable(thread * self){
+    atomic_signal_fence(memory_order_seq_cst);
+    if(--self->preempt_off > 0) return;
+    worker * w = this_worker();
+    if(w->preempt_pending){
+        w->preempt_pending = false;
+        preempt_yield(self);
     }
+}
 
-    TAILQ_REMOVE(&ready_queue, threads[id]->ent, entries);
-    threads[id]->state = 128;
-    delete_thread(threads[id]);
+static void preempt_block(worker * w, bool blocked){
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, PREEMPT_SIGNAL);
+    if(pthread_sigmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL) != 0) die("preempt sigmask");
+    w->preempt_blocked = blocked;
+}
 
-    if(DEBUG){
-        printf("\nCancel thread %d\n", id);
-        print_threads();
-        print_queue();
+// Called before switching to or from a growable thread. The tick has to be
+// blocked before we're on its stack, and swapcontext sets the mask `next`
+// was saved with while still on ours.
+static void preempt_hold(worker * w, thread * next){
+    if(!w->preempt_blocked) preempt_block(w, true);
+    context_block_signal(next->ctx_ptr, PREEMPT_SIGNAL);
+}
+
+static void preempt_handler(int sig){
+    (void) sig;
+    worker * w = this_worker();
+    if(w == NULL || w->current == w->idle) return;
+    if(w->switches != w->tick_switches){
+        w->tick_switches = w->switches;
+        return;
     }
-    return 0;
+    if(w->current->preempt_off > 0){
+        w->preempt_pending = true;
+        return;
+    }
+    int err = errno;
+    preempt_yield(w->current);
+    errno = err;
 }
 
-int wut_join(int id) {
-    if(TAILQ_EMPTY(&ready_queue)) return -1;
+static void arm_timers(void){
+    if(!preempt_installed){
+        struct sigaction sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sa_handler = preempt_handler;
+        sigemptyset(&sa.sa_mask);
+        // The handler may switch away and not return for a long time, the
+        // signal mustn't stay blocked on this worker in the meantime
+        sa.sa_flags = SA_RESTART | SA_NODEFER;
+        if(sigaction(PREEMPT_SIGNAL, &sa, NULL) == -1) die("preempt sigaction");
+        preempt_installed = true;
+    }
 
-    entry * old_head = TAILQ_FIRST(&ready_queue);
-    if(id < 0 || id > threads_capacity || threads[id] == NULL || id == old_head->val->id || threads[id]->block_id >= 0) return -1;
-    if(threads[id]->state >= 0){
-        int state = threads[id]->state;
-        threads[id] = NULL;
-        return state;
+    struct itimerspec its;
+    its.it_interval.tv_sec = preempt_quantum / 1000000;
+    its.it_interval.tv_nsec = preempt_quantum % 1000000 * 1000;
+    its.it_value = its.it_interval;
+    for(int i = 0; i < workers_count; i++){
+        worker * w = &workers[i];
+        if(!w->has_timer){
+            if(preempt_quantum == 0) continue;
+            clockid_t clock;
+            if(pthread_getcpuclockid(w->pthread, &clock) != 0) die("preempt clock");
+            struct sigevent sev;
+            memset(&sev, 0, sizeof sev);
+            sev.sigev_notify = SIGEV_THREAD_ID;
+            sev.sigev_signo = PREEMPT_SIGNAL;
+            sev.sigev_notify_thread_id = atomic_load(&w->tid);
+            if(timer_create(clock, &sev, &w->timer) == -1) die("preempt timer_create");
+            w->has_timer = true;
+        }
+        if(timer_settime(w->timer, 0, &its, NULL) == -1) die("preempt timer_settime");
     }
+}
 
-    old_head->val->state = -2;
-    threads[id]->block_id = old_head->val->id;
-    TAILQ_REMOVE(&ready_queue, old_head, entries);
+/* Stack Growth */
+// A growable stack starts with only its top page accessible. Touching
+// below that faults, and the SIGSEGV handler makes more of the stack
+// accessible, at least doubling what the thread had. The handler runs on
+// the worker's alternate signal stack, the thread's own has no room left.
+// Running into the guard is an overflow and aborts. Either way pages are
+// only committed once touched, what growing saves is commit charge: under
+// strict overcommit (vm.overcommit_memory=2) a PROT_NONE page isn't
+// counted, and MAP_NORESERVE is ignored.
+//
+// A growable thread isn't preempted. The tick is delivered on the running
+// thread's stack, and right below a frame that just grew there may be no
+// room for it: the kernel then kills the process with a SIGSEGV of its
+// own. The alternate stack is no way out, the handler switches threads and
+// would leave the preempted one's frame there. So the tick stays blocked
+// while a growable thread runs (see preempt_hold and finish_switch).
+#define ALTSTACK_SIZE (64 * 1024)
 
-    entry * new_head = TAILQ_FIRST(&ready_queue);
+static struct sigaction growth_old_action;
 
-    if(DEBUG){
-        printf("\nThread %d Join Thread %d\n", old_head->val->id, id);
-        print_threads();
-        print_queue();
+static void growth_handler(int sig, siginfo_t * info, void * uc){
+    char * addr = (char*) info->si_addr;
+    worker * w = this_worker();
+    stack * st = w == NULL ? NULL : &w->current->stack;
+    if(st != NULL && st->growable && addr >= st->base && addr < st->low){
+        if(addr < st->base + st->guard){
+            static const char message[] = "wut: thread stack overflow\n";
+            if(write(2, message, sizeof message - 1) < 0){}
+            abort();
+        }
+        char * top = stack_top(st);
+        size_t size = 2 * (size_t) (top - st->low);
+        size_t needed = top - (char*) ((uintptr_t) addr & ~(uintptr_t) (page_size() - 1));
+        if(size < needed) size = needed;
+        if(size > st->size) size = st->size;
+        if(mprotect(top - size, st->low - (top - size), PROT_READ | PROT_WRITE) == 0){
+            st->low = top - size;
+            return;
+        }
     }
+    // Not one of our stacks, it's for whatever handled SIGSEGV before us.
+    // We stay installed for the next fault.
+    if(growth_old_action.sa_flags & SA_SIGINFO){
+        growth_old_action.sa_sigaction(sig, info, uc);
+        return;
+    }
+    if(growth_old_action.sa_handler == SIG_IGN && info->si_code <= 0) return; // sent, not a fault
+    if(growth_old_action.sa_handler != SIG_DFL && growth_old_action.sa_handler != SIG_IGN){
+        growth_old_action.sa_handler(sig);
+        return;
+    }
+    // The default action, it's pending until we return and kills the
+    // process before the access can run again
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    raise(SIGSEGV);
+}
+
+// Only once a growable stack exists, so a SIGSEGV handler of the
+// application's own stays in charge until then
+static void growth_install(void){
+    growth_used = true;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = growth_handler;
+    sigemptyset(&sa.sa_mask);
+    // A preemption tick would switch threads on the alternate stack
+    sigaddset(&sa.sa_mask, PREEMPT_SIGNAL);
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    if(sigaction(SIGSEGV, &sa, &growth_old_action) == -1) die("growth sigaction");
+}
 
-    if(swapcontext(old_head->val->ctx_ptr, new_head->val->ctx_ptr) < 0) die("yield swap context");
+// Every worker's kernel thread needs its own alternate stack, unless the
+// application gave it one already
+static void growth_init_worker(void){
+    stack_t ss;
+    if(sigaltstack(NULL, &ss) == 0 && !(ss.ss_flags & SS_DISABLE)) return;
+    ss.ss_sp = malloc(ALTSTACK_SIZE);
+    if(ss.ss_sp == NULL) die("altstack malloc");
+    ss.ss_size = ALTSTACK_SIZE;
+    ss.ss_flags = 0;
+    if(sigaltstack(&ss, NULL) == -1) die("sigaltstack");
+}
 
-    if(DEBUG){
-        printf("\nThread %d Join Thread %d Finished\n", old_head->val->id, id);
-        print_threads();
-        print_queue();
-    }
+/* Timers */
+// Sleeping threads and timed joins sit in a hierarchical timing wheel with
+// 1 ms ticks. Level l has 64 slots of 64^l ticks each, a timer goes in the
+// lowest level its expiry fits in and moves down a level when the wheel
+// reaches its slot. Adding or removing a timer is O(1), and every tick
+// costs O(1) plus the timers it moves or fires.
+#define TIMER_TICK_NS 1000000
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
 
-    int state = threads[id]->state;
-    threads[id] = NULL;
-    return state;
+LIST_HEAD(timer_list, thread);
+static struct timer_list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_bitmap[WHEEL_LEVELS]; // non-empty slots
+static uint64_t wheel_tick; // every tick before this one has been run
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-int wut_yield() {
-    entry * old_head = TAILQ_FIRST(&ready_queue);
-    if(TAILQ_NEXT(old_head, entries) == NULL) return -1;
-    TAILQ_REMOVE(&ready_queue, old_head, entries);
-    TAILQ_INSERT_TAIL(&ready_queue, old_head, entries);
+// Called with wut_lock held
+static void wheel_insert(thread * th){
+    uint64_t expires = th->expires < wheel_tick ? wheel_tick : th->expires;
+    uint64_t delta = expires - wheel_tick;
+    int level = 0;
+    while(level < WHEEL_LEVELS - 1 && delta >= (uint64_t) 1 << (WHEEL_BITS * (level + 1))) level++;
+    // Past the top level, park it in the furthest slot and look again later
+    uint64_t limit = ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    if(delta > limit) expires = wheel_tick + limit;
+    int slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+    LIST_INSERT_HEAD(&wheel[level][slot], th, timer_entries);
+    wheel_bitmap[level] |= (uint64_t) 1 << slot;
+    th->timer_level = level;
+    th->timer_slot = slot;
+}
 
-    if(DEBUG){
-        printf("\nYield thread %d\n", old_head->val->id);
-        print_queue();
+static void wheel_unlink(thread * th){
+    LIST_REMOVE(th, timer_entries);
+    if(LIST_EMPTY(&wheel[th->timer_level][th->timer_slot])){
+        wheel_bitmap[th->timer_level] &= ~((uint64_t) 1 << th->timer_slot);
     }
+}
 
-    entry * new_head = TAILQ_FIRST(&ready_queue);
-    if(swapcontext(old_head->val->ctx_ptr, new_head->val->ctx_ptr) < 0) die("yield swap context");
-    return 0;
+static void timer_add(thread * th, long ns){
+    uint64_t now = now_ns();
+    // Nothing has moved the wheel while it was empty
+    if(atomic_load(&timers_armed) == 0) wheel_tick = now / TIMER_TICK_NS;
+    uint64_t deadline = now + ns;
+    th->expires = (deadline + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+    th->timer_armed = true;
+    th->timed_out = false;
+    atomic_fetch_add(&timers_armed, 1);
+    wheel_insert(th);
 }
 
-// The Correct Way to Exit The Thread
-// 1. 在exit和cancel中，删除thread除了status之外的所有信息
-// 2. 如果有其他thread想join这个thread，那就在join结束后，删除status信息
-// 3. 如果没有其他thread想join这个thread，那就在检查TCB Array时，怕断所哟欧status大于0的Entry为可以使用的Entry，并覆盖该Entry对的信息
-void wut_exit(int status) {
-    entry * head = TAILQ_FIRST(&ready_queue);
-    status &= 0xFF;
-    head->val->state = status;
+// Called with wut_lock held
+static void timer_remove(thread * th){
+    wheel_unlink(th);
+    th->timer_armed = false;
+    atomic_fetch_sub(&timers_armed, 1);
+}
 
-    if(DEBUG){
-        printf("\nExit Thread %d\n", head->val->id);
-        print_threads();
-        print_queue();
+// The timer went off before whatever the thread waited for
+static void timer_fire(worker * w, thread * th){
+    th->timer_armed = false;
+    atomic_fetch_sub(&timers_armed, 1);
+    th->timed_out = true;
+    if(th->state == -2) join_forget(th);
+    if(th->state == -5) waitq_remove(th->waiting_on, th);
+    wake_thread(w, th);
+}
+
+static void wheel_run_tick(worker * w, uint64_t tick){
+    for(int level = 1; level < WHEEL_LEVELS; level++){
+        if(tick & (((uint64_t) 1 << (WHEEL_BITS * level)) - 1)) break;
+        // Most of these move to a lower level, the ones due a full turn
+        // later go back in the same slot
+        int slot = (tick >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1);
+        struct timer_list moving = LIST_HEAD_INITIALIZER(moving);
+        thread * th;
+        while((th = LIST_FIRST(&wheel[level][slot])) != NULL){
+            LIST_REMOVE(th, timer_entries);
+            LIST_INSERT_HEAD(&moving, th, timer_entries);
+        }
+        wheel_bitmap[level] &= ~((uint64_t) 1 << slot);
+        while((th = LIST_FIRST(&moving)) != NULL){
+            LIST_REMOVE(th, timer_entries);
+            wheel_insert(th);
+        }
     }
+    int slot = tick & (WHEEL_SIZE - 1);
+    thread * th;
+    while((th = LIST_FIRST(&wheel[0][slot])) != NULL){
+        wheel_unlink(th);
+        timer_fire(w, th);
+    }
+}
 
-    if(swapcontext(head->val->ctx_ptr, scheduler_ptr) < 0) die("yield swap context");
+// Ticks until the next slot that needs looking at, from `wheel_tick`
+static uint64_t wheel_next(void){
+    uint64_t ticks = UINT64_MAX;
+    for(int level = 0; level < WHEEL_LEVELS; level++){
+        if(wheel_bitmap[level] == 0) continue;
+        int shift = WHEEL_BITS * level;
+        int current = (wheel_tick >> shift) & (WHEEL_SIZE - 1);
+        // Rotate so the current slot is bit 0
+        uint64_t bits = wheel_bitmap[level];
+        uint64_t rotated = current == 0 ? bits : (bits >> current) | (bits << (WHEEL_SIZE - current));
+        // Above level 0, the current slot was moved down when the wheel ran
+        // its first tick, after that it only comes around a full turn later
+        int passed = level > 0 && (wheel_tick & (((uint64_t) 1 << shift) - 1)) != 0;
+        if(passed) rotated = (rotated >> 1) | (rotated << (WHEEL_SIZE - 1));
+        uint64_t ahead = __builtin_ctzll(rotated) + passed;
+        uint64_t start = ((wheel_tick >> shift) + ahead) << shift;
+        uint64_t next = start > wheel_tick ? start - wheel_tick : 0;
+        if(next < ticks) ticks = next;
+    }
+    return ticks;
+}
+
+// Fire every timer that's due, returns whether any did. Stretches without
+// anything to move or fire are skipped.
+static bool timers_run(worker * w){
+    if(atomic_load_explicit(&timers_armed, memory_order_relaxed) == 0) return false;
+    uint64_t now = now_ns() / TIMER_TICK_NS;
+    spin_lock(&wut_lock);
+    int before = atomic_load(&timers_armed);
+    while(wheel_tick <= now){
+        uint64_t next = wheel_next();
+        if(next > now - wheel_tick){
+            wheel_tick = now + 1;
+            break;
+        }
+        wheel_tick += next;
+        wheel_run_tick(w, wheel_tick);
+        wheel_tick++;
+    }
+    bool fired = atomic_load(&timers_armed) != before;
+    spin_unlock(&wut_lock);
+    return fired;
+}
+
+// How long an idle worker may sleep before the next timer, -1 is forever
+static int timers_timeout_ms(void){
+    if(atomic_load(&timers_armed) == 0) return -1;
+    spin_lock(&wut_lock);
+    uint64_t ticks = wheel_next();
+    uint64_t deadline = (wheel_tick + ticks) * TIMER_TICK_NS;
+    spin_unlock(&wut_lock);
+    uint64_t now = now_ns();
+    if(ticks == UINT64_MAX || deadline <= now) return 0;
+    return (int) ((deadline - now + 999999) / 1000000);
+}
+
+/* Reactor */
+// Threads waiting for I/O are parked off the run queues with a one-shot
+// epoll registration that carries their ID and fd. Workers check for
+// events every REACTOR_POLL_INTERVAL switches, and when there's nothing
+// else to run one of them blocks in epoll_wait.
+#define REACTOR_POLL_INTERVAL 64
+#define REACTOR_EVENTS 64
+#define REACTOR_WAKE UINT64_MAX
+
+static int epoll_fd = -1;
+static atomic_bool reactor_busy;
+
+// Called with wut_lock held
+static int reactor_init(void){
+    if(epoll_fd >= 0) return 0;
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    if(fd < 0) return -1;
+    reactor_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(reactor_wake_fd < 0) die("reactor eventfd");
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = REACTOR_WAKE };
+    if(epoll_ctl(fd, EPOLL_CTL_ADD, reactor_wake_fd, &ev) == -1) die("reactor epoll_ctl");
+    epoll_fd = fd;
+    return 0;
+}
+
+static void reactor_poll(worker * w, int timeout){
+    struct epoll_event events[REACTOR_EVENTS];
+    int n = epoll_wait(epoll_fd, events, REACTOR_EVENTS, timeout);
+    if(n <= 0) return;
+    spin_lock(&wut_lock);
+    for(int i = 0; i < n; i++){
+        uint64_t data = events[i].data.u64;
+        if(data == REACTOR_WAKE){
+            uint64_t count;
+            ssize_t ignored = read(reactor_wake_fd, &count, sizeof count);
+            (void) ignored;
+            continue;
+        }
+        // The thread may have been cancelled (and its ID reused) since
+        int id = (int) (data & 0xFFFFFFFF);
+        int fd = (int) (data >> 32);
+        thread * th = id < threads_capacity ? threads[id] : NULL;
+        if(th == NULL || th->state != -3 || th->io_fd != fd) continue;
+        th->io_events = events[i].events;
+        atomic_fetch_sub(&io_waiters, 1);
+        wake_thread(w, th);
+    }
+    spin_unlock(&wut_lock);
+}
+
+// Block until there's I/O or another thread to run, unless some other
+// worker is already doing that.
+static bool reactor_wait(worker * w){
+    if(atomic_exchange(&reactor_busy, true)) return false;
+    // Only sleepers so far, epoll is just used to wait
+    if(epoll_fd < 0){
+        spin_lock(&wut_lock);
+        int err = reactor_init();
+        spin_unlock(&wut_lock);
+        if(err < 0) die("reactor epoll_create1");
+    }
+    atomic_store(&reactor_sleeping, true);
+    // Pairs with the fence in enqueue()
+    atomic_thread_fence(memory_order_seq_cst);
+    reactor_poll(w, any_work() ? 0 : timers_timeout_ms());
+    atomic_store(&reactor_sleeping, false);
+    atomic_store(&reactor_busy, false);
+    return true;
+}
+
+// Called with wut_lock held, the thread is cancelled
+static void reactor_forget(thread * th){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, th->io_fd, NULL);
+    atomic_fetch_sub(&io_waiters, 1);
+}
+
+// Park until `fd` has one of `events`, returns the events seen
+static int io_wait(thread * self, int fd, uint32_t events){
+    worker * w = this_worker();
+    spin_lock(&wut_lock);
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    if(reactor_init() < 0){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u64 = (uint64_t) fd << 32 | (uint32_t) self->id;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1 &&
+       (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+    self->state = -3;
+    self->io_fd = fd;
+    self->io_events = 0;
+    atomic_fetch_add(&io_waiters, 1);
+    leave_runnable();
+
+    // Same as join, whoever wakes us has to wait until we're off our stack
+    w->unlock_prev = true;
+    switch_to(w, pick_next(w));
+    check_cancel(self);
+    return (int) self->io_events;
+}
+
+static int wait_fd(int fd, uint32_t events){
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = io_wait(self, fd, events);
+    preempt_enable(self);
+    return result;
+}
+
+static bool would_block(void){
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/* Synchronisation */
+// Mutexes, condition variables, semaphores and rwlocks keep their waiters
+// in a FIFO on the object itself. Releasing hands the object straight to
+// the first waiter, so a woken thread never has to compete for it again.
+// An uncontended mutex lock or unlock, and a semaphore wait that finds a
+// count, are a single atomic. Anything that queues or wakes a thread runs
+// under wut_lock, and so does every semaphore post, which has to look for
+// a waiter first.
+typedef struct mutex{
+    atomic_int state; // 0 unlocked, 1 locked, 2 locked and maybe waiters
+    int owner;
+    waitq waiters;
+} mutex;
+
+typedef struct cond{
+    waitq waiters;
+} cond;
+
+typedef struct sem{
+    atomic_uint count;
+    waitq waiters;
+} sem;
+
+#define RWLOCK_READ 0
+#define RWLOCK_WRITE 1
+
+typedef struct rwlock{
+    int readers; // -1 while a writer holds it
+    waitq waiters;
+} rwlock;
+
+_Static_assert(sizeof (mutex) <= sizeof (wut_mutex), "wut_mutex is too small");
+_Static_assert(sizeof (cond) <= sizeof (wut_cond), "wut_cond is too small");
+_Static_assert(sizeof (sem) <= sizeof (wut_sem), "wut_sem is too small");
+typedef struct waitgroup{
+    atomic_long count;
+    waitq waiters;
+} waitgroup;
+
+_Static_assert(sizeof (rwlock) <= sizeof (wut_rwlock), "wut_rwlock is too small");
+_Static_assert(sizeof (waitgroup) <= sizeof (wut_waitgroup), "wut_waitgroup is too small");
+
+// Called with wut_lock held once we're in a wait queue, the lock is
+// released once we're off our stack. Returns when someone has handed us
+// what we waited for.
+static void waitq_block(thread * self){
+    self->state = -5;
+    leave_runnable();
+    worker * w = this_worker();
+    w->unlock_prev = true;
+    switch_to(w, pick_next(w));
+}
+
+static void waitq_wait(waitq * q, thread * self, int mode){
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    waitq_push(q, self, mode);
+    waitq_block(self);
+}
+
+// Called with wut_lock held. Either `th` gets the mutex right away, or it
+// queues for it.
+static bool mutex_take_or_queue(mutex * m, thread * th){
+    if(atomic_exchange(&m->state, 2) == 0){
+        m->owner = th->id;
+        return true;
+    }
+    waitq_push(&m->waiters, th, 0);
+    return false;
+}
+
+// Called with wut_lock held
+static void mutex_release(mutex * m){
+    thread * next = waitq_pop(&m->waiters);
+    if(next == NULL){
+        atomic_store(&m->state, 0);
+        return;
+    }
+    m->owner = next->id;
+    wake_thread(this_worker(), next);
+}
+
+static int mutex_lock(mutex * m, thread * self){
+    int unlocked = 0;
+    if(atomic_compare_exchange_strong(&m->state, &unlocked, 1)){
+        m->owner = self->id;
+        return 0;
+    }
+    spin_lock(&wut_lock);
+    if(m->owner == self->id && atomic_load(&m->state) != 0){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    if(mutex_take_or_queue(m, self)){
+        spin_unlock(&wut_lock);
+        return 0;
+    }
+    waitq_block(self);
+    return 0;
+}
+
+static int mutex_unlock(mutex * m, thread * self){
+    if(atomic_load(&m->state) == 0 || m->owner != self->id) return -1;
+    m->owner = -1;
+    int locked = 1;
+    if(atomic_compare_exchange_strong(&m->state, &locked, 0)) return 0;
+    spin_lock(&wut_lock);
+    mutex_release(m);
+    spin_unlock(&wut_lock);
+    return 0;
+}
+
+// Waits for at most `ns` nanoseconds, unless `ns` is negative
+static int cond_wait(cond * c, mutex * m, thread * self, long ns){
+    if(atomic_load(&m->state) == 0 || m->owner != self->id) return -1;
+    spin_lock(&wut_lock);
+    m->owner = -1;
+    mutex_release(m);
+    self->wait_mutex = m;
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    waitq_push(&c->waiters, self, 0);
+    if(ns >= 0) timer_add(self, ns);
+    waitq_block(self);
+    if(self->timed_out){
+        // The timer took us off the queue, nobody got us the mutex
+        self->timed_out = false;
+        mutex_lock(m, self);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    // Whoever signalled us also got us the mutex
+    return 0;
+}
+
+// Called with wut_lock held. The waiter goes straight on to the mutex it
+// waited with, it only runs again once it holds it. Its timeout is over,
+// it was signalled in time.
+static void cond_wake_one(cond * c){
+    thread * th = waitq_pop(&c->waiters);
+    if(th->timer_armed) timer_remove(th);
+    if(mutex_take_or_queue(th->wait_mutex, th)) wake_thread(this_worker(), th);
+}
+
+static int sem_wait(sem * s, thread * self){
+    unsigned count = atomic_load(&s->count);
+    while(count > 0){
+        if(atomic_compare_exchange_weak(&s->count, &count, count - 1)) return 0;
+    }
+    spin_lock(&wut_lock);
+    count = atomic_load(&s->count);
+    while(count > 0){
+        if(atomic_compare_exchange_weak(&s->count, &count, count - 1)){
+            spin_unlock(&wut_lock);
+            return 0;
+        }
+    }
+    waitq_wait(&s->waiters, self, 0);
+    return 0;
+}
+
+static int sem_post(sem * s){
+    spin_lock(&wut_lock);
+    thread * next = waitq_pop(&s->waiters);
+    if(next != NULL) wake_thread(this_worker(), next);
+    else atomic_fetch_add(&s->count, 1);
+    spin_unlock(&wut_lock);
+    return 0;
+}
+
+static int rwlock_lock(rwlock * rw, thread * self, int mode){
+    spin_lock(&wut_lock);
+    // Readers don't overtake a queued writer
+    if(rw->waiters.head == NULL){
+        if(mode == RWLOCK_READ && rw->readers >= 0){
+            rw->readers++;
+            spin_unlock(&wut_lock);
+            return 0;
+        }
+        if(mode == RWLOCK_WRITE && rw->readers == 0){
+            rw->readers = -1;
+            spin_unlock(&wut_lock);
+            return 0;
+        }
+    }
+    waitq_wait(&rw->waiters, self, mode);
+    return 0;
+}
+
+static int rwlock_unlock(rwlock * rw){
+    spin_lock(&wut_lock);
+    if(rw->readers == 0){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+    if(rw->readers > 0) rw->readers--;
+    else rw->readers = 0;
+    if(rw->readers == 0){
+        // A writer at the head gets it alone, otherwise every reader up to
+        // the next writer
+        thread * head = rw->waiters.head;
+        if(head != NULL && head->wait_mode == RWLOCK_WRITE){
+            rw->readers = -1;
+            wake_thread(this_worker(), waitq_pop(&rw->waiters));
+        }
+        else{
+            while(rw->waiters.head != NULL && rw->waiters.head->wait_mode == RWLOCK_READ){
+                rw->readers++;
+                wake_thread(this_worker(), waitq_pop(&rw->waiters));
+            }
+        }
+    }
+    spin_unlock(&wut_lock);
+    return 0;
+}
+
+// Only dropping the count to zero takes wut_lock, to wake every waiter
+static int waitgroup_add(waitgroup * wg, long delta){
+    long count = atomic_fetch_add(&wg->count, delta) + delta;
+    if(count < 0){
+        atomic_fetch_sub(&wg->count, delta);
+        return -1;
+    }
+    if(count > 0 || delta == 0) return 0;
+    spin_lock(&wut_lock);
+    thread * th;
+    while((th = waitq_pop(&wg->waiters)) != NULL){
+        wake_thread(this_worker(), th);
+    }
+    spin_unlock(&wut_lock);
+    return 0;
+}
+
+static int waitgroup_wait(waitgroup * wg, thread * self){
+    if(atomic_load(&wg->count) == 0) return 0;
+    spin_lock(&wut_lock);
+    // The last waitgroup_add has to take wut_lock to wake us
+    if(atomic_load(&wg->count) == 0){
+        spin_unlock(&wut_lock);
+        return 0;
+    }
+    waitq_wait(&wg->waiters, self, 0);
+    return 0;
+}
+
+/* Groups */
+// Threads created with a group in their attributes are reaped through the
+// group instead of wut_join, so a parent can collect any number of them
+// with one call (and one switch, when it has to wait at all).
+typedef struct group{
+    int members; // created and not reaped yet
+    int exited_count;
+    thread * exited; // exited members, linked through next_wait
+    waitq any_waiters; // in wut_join_any
+    waitq all_waiters; // in wut_group_wait
+} group;
+
+_Static_assert(sizeof (group) <= sizeof (wut_group), "wut_group is too small");
+
+// Called with wut_lock held
+static void group_exited(group * g, thread * th){
+    th->next_wait = g->exited;
+    g->exited = th;
+    g->exited_count++;
+    thread * waiter = waitq_pop(&g->any_waiters);
+    if(waiter != NULL) wake_thread(this_worker(), waiter);
+    if(g->exited_count == g->members){
+        while((waiter = waitq_pop(&g->all_waiters)) != NULL){
+            wake_thread(this_worker(), waiter);
+        }
+    }
+}
+
+// Called with wut_lock held
+static int group_reap(group * g, int * status){
+    thread * th = g->exited;
+    g->exited = th->next_wait;
+    g->exited_count--;
+    g->members--;
+    int id = th->id;
+    if(status != NULL) *status = th->state;
+    free_thread(th);
+    return id;
+}
+
+static int join_any(group * g, thread * self, int * status){
+    spin_lock(&wut_lock);
+    while(g->exited == NULL){
+        if(g->members == 0){
+            spin_unlock(&wut_lock);
+            errno = ECHILD;
+            return -1;
+        }
+        waitq_wait(&g->any_waiters, self, 0);
+        spin_lock(&wut_lock);
+    }
+    int id = group_reap(g, status);
+    spin_unlock(&wut_lock);
+    return id;
+}
+
+static int group_wait(group * g, thread * self){
+    spin_lock(&wut_lock);
+    while(g->exited_count < g->members){
+        waitq_wait(&g->all_waiters, self, 0);
+        spin_lock(&wut_lock);
+    }
+    int reaped = 0;
+    while(g->exited != NULL){
+        group_reap(g, NULL);
+        reaped++;
+    }
+    spin_unlock(&wut_lock);
+    return reaped;
+}
+
+/* Channels */
+// A channel is a ring buffer plus the threads waiting to send and receive
+// on it. When a thread already waits on the other side the element is
+// copied straight from the sender's memory to the receiver's, and the
+// waiter is woken with its operation done, so it doesn't have to retry.
+// Everything runs under wut_lock, which is also what lets one thread wait
+// on several channels at once in wut_select.
+typedef struct chan_wait{
+    thread * th;
+    struct chan_node * nodes; // one for each case, on the waiter's stack
+    int count;
+    int fired; // the case that went ahead
+    int result;
+} chan_wait;
+
+typedef struct chan_node{
+    chan_wait * wait;
+    wut_chan * chan;
+    void * elem;
+    int index;
+    bool send;
+    TAILQ_ENTRY(chan_node) entries;
+} chan_node;
+
+TAILQ_HEAD(chan_queue, chan_node);
+
+struct wut_chan{
+    size_t elem_size;
+    long capacity; // WUT_CHAN_UNBOUNDED grows the buffer as needed
+    bool closed;
+    char * buf;
+    size_t head, count, size; // size is the slots in buf
+    struct chan_queue senders;
+    struct chan_queue receivers;
+};
+
+#define CHAN_INITIAL_SIZE 16
+
+static unsigned select_start; // rotates so no case is always tried first
+
+static char * chan_slot(wut_chan * c, size_t i){
+    return c->buf + ((c->head + i) % c->size) * c->elem_size;
+}
+
+static void chan_push(wut_chan * c, const void * elem){
+    if(c->count == c->size){
+        // Only unbounded channels get here, unwrap into a buffer twice as big
+        size_t size = c->size * 2;
+        char * buf = malloc(size * c->elem_size);
+        if(buf == NULL) die("channel buffer malloc");
+        for(size_t i = 0; i < c->count; i++){
+            memcpy(buf + i * c->elem_size, chan_slot(c, i), c->elem_size);
+        }
+        free(c->buf);
+        c->buf = buf;
+        c->head = 0;
+        c->size = size;
+    }
+    memcpy(chan_slot(c, c->count), elem, c->elem_size);
+    c->count++;
+}
+
+static void chan_pop(wut_chan * c, void * elem){
+    memcpy(elem, chan_slot(c, 0), c->elem_size);
+    c->head = (c->head + 1) % c->size;
+    c->count--;
+}
+
+static void chan_unlink(chan_wait * wait){
+    for(int i = 0; i < wait->count; i++){
+        chan_node * node = &wait->nodes[i];
+        if(node->chan == NULL) continue;
+        if(node->send) TAILQ_REMOVE(&node->chan->senders, node, entries);
+        else TAILQ_REMOVE(&node->chan->receivers, node, entries);
+    }
+}
+
+// Called with wut_lock held. The waiter's operation on `node` is done,
+// it's no longer waiting on anything else.
+static void chan_wake(chan_node * node, int result){
+    chan_wait * wait = node->wait;
+    wait->fired = node->index;
+    wait->result = result;
+    chan_unlink(wait);
+    wake_thread(this_worker(), wait->th);
+}
+
+static void chan_forget(thread * th){
+    chan_unlink(th->chan_wait);
+}
+
+// Called with wut_lock held. Does the operation if it can go ahead right
+// now, a closed channel always can (it fails).
+static bool chan_try(wut_chan_case * cs){
+    wut_chan * c = cs->chan;
+    if(cs->op == WUT_CHAN_SEND){
+        cs->result = -1;
+        if(c->closed) return true;
+        chan_node * receiver = TAILQ_FIRST(&c->receivers);
+        if(receiver != NULL){
+            memcpy(receiver->elem, cs->elem, c->elem_size);
+            chan_wake(receiver, 0);
+        }
+        else if(c->capacity == WUT_CHAN_UNBOUNDED || c->count < (size_t) c->capacity){
+            chan_push(c, cs->elem);
+        }
+        else return false;
+        cs->result = 0;
+        return true;
+    }
+
+    chan_node * sender = TAILQ_FIRST(&c->senders);
+    if(c->count > 0){
+        chan_pop(c, cs->elem);
+        // The buffer was full, the first sender takes the free slot
+        if(sender != NULL){
+            chan_push(c, sender->elem);
+            chan_wake(sender, 0);
+        }
+    }
+    else if(sender != NULL){
+        memcpy(cs->elem, sender->elem, c->elem_size);
+        chan_wake(sender, 0);
+    }
+    else if(c->closed){
+        memset(cs->elem, 0, c->elem_size);
+        cs->result = -1;
+        return true;
+    }
+    else return false;
+    cs->result = 0;
+    return true;
+}
+
+static int chan_select(thread * self, wut_chan_case * cases, int count, bool block){
+    spin_lock(&wut_lock);
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    int start = select_start++;
+    bool any = false;
+    for(int k = 0; k < count; k++){
+        int i = (int) ((start + k) % (unsigned) count);
+        if(cases[i].chan == NULL) continue;
+        any = true;
+        if(chan_try(&cases[i])){
+            spin_unlock(&wut_lock);
+            return i;
+        }
+    }
+    // Nothing to wait for would block forever
+    if(!block || !any){
+        spin_unlock(&wut_lock);
+        errno = block ? EINVAL : EAGAIN;
+        return -1;
+    }
+
+    chan_node nodes[count];
+    chan_wait wait = { self, nodes, count, -1, -1 };
+    for(int i = 0; i < count; i++){
+        chan_node * node = &nodes[i];
+        node->wait = &wait;
+        node->chan = cases[i].chan;
+        node->elem = cases[i].elem;
+        node->index = i;
+        node->send = cases[i].op == WUT_CHAN_SEND;
+        if(node->chan == NULL) continue;
+        if(node->send) TAILQ_INSERT_TAIL(&node->chan->senders, node, entries);
+        else TAILQ_INSERT_TAIL(&node->chan->receivers, node, entries);
+    }
+    self->chan_wait = &wait;
+    self->state = -6;
+    leave_runnable();
+    worker * w = this_worker();
+    w->unlock_prev = true;
+    switch_to(w, pick_next(w));
+
+    // Whoever woke us did the operation already
+    cases[wait.fired].result = wait.result;
+    return wait.fired;
+}
+
+/* Tasks */
+// The task pool is a channel of tasks and the threads that receive from
+// it. A task sent while a pool thread waits goes straight to that thread,
+// otherwise it waits in the channel's buffer, which is the bounded queue.
+#define TASK_THREADS_PER_WORKER 4
+#define TASK_QUEUE_DEFAULT 256
+#define TASK_POOL_STOPPED 0
+#define TASK_POOL_STARTING 1
+#define TASK_POOL_RUNNING 2
+
+typedef struct task{
+    void (*fn)(void *);
+    void * arg;
+    wut_waitgroup * wg;
+} task;
+
+static wut_chan * task_chan;
+static atomic_int task_pool_state;
+
+static void task_thread(void){
+    task t;
+    while(wut_chan_recv(task_chan, &t) == 0){
+        t.fn(t.arg);
+        if(t.wg != NULL) wut_waitgroup_done(t.wg);
+    }
+}
+
+/* Thread-local Storage */
+// A key is an index into every TCB's `specific` array, so a lookup is a
+// single load. Only slots below `keys_count` are ever set, and an exiting
+// thread clears them all, so recycled TCBs never need clearing.
+static void (*key_destructors[WUT_KEYS_MAX])(void *);
+static atomic_int keys_count;
+
+// Moves the thread's values into `values` and clears its slots, returns
+// how many slots there are
+static int take_specific(thread * th, void ** values){
+    int count = atomic_load_explicit(&keys_count, memory_order_acquire);
+    for(int key = 0; key < count; key++){
+        values[key] = th->specific[key];
+        th->specific[key] = NULL;
+    }
+    return count;
+}
+
+// Returns whether any destructor ran
+static bool destroy_specific(void ** values, int count){
+    bool ran = false;
+    for(int key = 0; key < count; key++){
+        if(values[key] != NULL && key_destructors[key] != NULL){
+            key_destructors[key](values[key]);
+            ran = true;
+        }
+    }
+    return ran;
+}
+
+// Runs on the exiting thread, destructors may set values again
+static void run_destructors(thread * self){
+    void * values[WUT_KEYS_MAX];
+    for(int i = 0; i < WUT_DESTRUCTOR_ITERATIONS; i++){
+        if(!destroy_specific(values, take_specific(self, values))) return;
+    }
+    // Whatever the last round set is dropped
+    take_specific(self, values);
+}
+
+/* Library Functions */
+void wut_init() {
+    wut_init_workers(1);
+}
+
+int wut_init_workers(int count) {
+    if(count < 1) return -1;
+    workers_count = count;
+
+    /* Threads Pool */
+    threads_count = 0;
+    next_id = 0;
+    free_ids_count = 0;
+    threads_capacity = 10;
+    threads = (thread**) malloc(threads_capacity * sizeof (thread*));
+    if(threads == NULL) die("threads malloc");
+    for(int i = 0; i < threads_capacity; i++){
+        threads[i] = NULL;
+    }
+
+    /* Workers */
+    wut_attr attr;
+    wut_attr_init(&attr);
+    workers = (worker*) calloc(count, sizeof (worker));
+    if(workers == NULL) die("workers calloc");
+    for(int i = 0; i < count; i++){
+        workers[i].index = i;
+        for(int level = 0; level < PRIORITY_LEVELS; level++){
+            TAILQ_INIT(&workers[i].runq[level]);
+        }
+        // Only worker 0 needs a stack for its idle thread, the others idle
+        // on their kernel thread's stack
+        workers[i].idle = create_thread(i == 0 ? schedule : NULL, &attr);
+        if(workers[i].idle == NULL) die("idle thread");
+    }
+    current_worker = &workers[0];
+    growth_init_worker();
+    workers[0].pthread = pthread_self();
+    atomic_store(&workers[0].tid, syscall(SYS_gettid));
+
+    /* Main Thread */
+    thread * main_thread = create_thread(NULL, &attr);
+    register_thread(main_thread);
+    workers[0].current = main_thread;
+    current_thread = main_thread;
+    atomic_store(&runnable, 1);
+
+    /* Timers */
+    for(int level = 0; level < WHEEL_LEVELS; level++){
+        for(int slot = 0; slot < WHEEL_SIZE; slot++) LIST_INIT(&wheel[level][slot]);
+    }
+    wheel_tick = now_ns() / TIMER_TICK_NS;
+
+    for(int i = 1; i < count; i++){
+        if(pthread_create(&workers[i].pthread, NULL, worker_main, &workers[i]) != 0) die("worker pthread_create");
+        pthread_detach(workers[i].pthread);
+    }
+    // The timers need every worker's kernel thread ID
+    for(int i = 1; i < count; i++){
+        while(atomic_load(&workers[i].tid) == 0) kernel_yield();
+    }
+    if(preempt_quantum > 0) arm_timers();
+
+    if(DEBUG){
+        printf("Initial Thread %d\n", main_thread->id);
+        print_threads();
+        print_queue();
+    }
+    return 0;
+}
+
+int wut_id() {
+    thread * self = this_thread();
+    // A worker's idle thread has no ID either
+    return self == NULL ? -1 : self->id;
+}
+
+void wut_attr_init(wut_attr * attr) {
+    attr->stack_size = STACK_SIZE_DEFAULT;
+    attr->guard_size = page_size();
+    attr->group = NULL;
+    attr->priority = WUT_PRIORITY_DEFAULT;
+    attr->growable = 0;
+}
+
+int wut_create(void (*run)(void)) {
+    return wut_create_ex(run, NULL);
+}
+
+static void run_with_arg(void){
+    thread * self = this_thread();
+    self->run_arg(self->arg);
+}
+
+static int start_thread(void (*run)(void), void (*run_arg)(void *), void * arg, const wut_attr * attr) {
+    wut_attr defaults;
+    if(attr == NULL){
+        wut_attr_init(&defaults);
+        attr = &defaults;
+    }
+    thread * self = this_thread();
+    preempt_disable(self);
+    thread * new_thread = create_thread(run, attr);
+    if(new_thread == NULL){
+        preempt_enable(self);
+        return -1;
+    }
+    new_thread->run_arg = run_arg;
+    new_thread->arg = arg;
+
+    spin_lock(&wut_lock);
+    register_thread(new_thread);
+    int id = new_thread->id;
+    if(new_thread->group != NULL) new_thread->group->members++;
+    if(tracing) trace_record(this_worker(), TRACE_CREATE, id, self->id, 0);
+    atomic_fetch_add(&runnable, 1);
+    enqueue(this_worker(), new_thread);
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+
+    if(DEBUG){
+        printf("\nCreate new thread %d\n", id);
+        print_threads();
+        print_queue();
+    }
+
+    return id;
+}
+
+int wut_create_ex(void (*run)(void), const wut_attr * attr) {
+    return start_thread(run, NULL, NULL, attr);
+}
+
+int wut_create_arg(void (*run)(void *), void * arg, const wut_attr * attr) {
+    return start_thread(run_with_arg, run, arg, attr);
+}
+
+static void reactor_forget(thread * th);
+static void chan_forget(thread * th);
+
+static int cancel_thread(thread * self, int id) {
+    spin_lock(&wut_lock);
+    if(id < 0 || id >= threads_capacity || threads[id] == NULL || self->id == id){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+    thread * target = threads[id];
+    // Already exited (or on its way out), there's nothing left to cancel
+    if(target->state >= 0 || atomic_load(&target->cancel_pending)){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+
+    // Runnable but not in a queue, it's running on another worker. We can't
+    // stop it from here, it exits the next time it yields or joins.
+    if(target->state == -1 && !dequeue_thread(target)){
+        atomic_store(&target->cancel_pending, true);
+        spin_unlock(&wut_lock);
+        return 0;
+    }
+    if(target->state == -1) leave_runnable();
+    if(target->state == -3) reactor_forget(target);
+    if(target->state == -2) join_forget(target);
+    if(target->state == -5) waitq_remove(target->waiting_on, target);
+    if(target->state == -6) chan_forget(target);
+
+    if(target->timer_armed) timer_remove(target);
+    target->state = 128;
+    delete_thread(target);
+    thread_exited(this_worker(), target);
+    // It never runs again, so its destructors run here, once we let go of
+    // the lock
+    void * values[WUT_KEYS_MAX];
+    int count = take_specific(target, values);
+    spin_unlock(&wut_lock);
+    destroy_specific(values, count);
+
+    if(DEBUG){
+        printf("\nCancel thread %d\n", id);
+        print_threads();
+        print_queue();
+    }
+    return 0;
+}
+
+static int join_thread(thread * self, int id, long timeout_ns) {
+    worker * w = this_worker();
+    spin_lock(&wut_lock);
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    if(id < 0 || id >= threads_capacity || threads[id] == NULL || id == self->id || threads[id]->group != NULL){
+        spin_unlock(&wut_lock);
+        return -1;
+    }
+
+    thread * target = threads[id];
+    if(target->state < 0){
+        self->state = -2;
+        self->join_id = id;
+        waitq_push(&target->joiners, self, 0);
+        target->join_refs++;
+        if(timeout_ns >= 0) timer_add(self, timeout_ns);
+        leave_runnable();
+
+        if(DEBUG){
+            printf("\nThread %d Join Thread %d\n", self->id, id);
+            print_threads();
+            print_queue();
+        }
+
+        // wut_lock stays held until we're off our stack, whoever wakes us
+        // has to take it first
+        w->unlock_prev = true;
+        switch_to(w, pick_next(w));
+        spin_lock(&wut_lock);
+
+        if(DEBUG){
+            printf("\nThread %d Join Thread %d Finished\n", self->id, id);
+            print_threads();
+            print_queue();
+        }
+
+        if(self->timed_out){
+            self->timed_out = false;
+            spin_unlock(&wut_lock);
+            check_cancel(self);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        target->join_refs--;
+    }
+
+    int state = target->state;
+    if(target->join_refs == 0) free_thread(target);
+    spin_unlock(&wut_lock);
+    check_cancel(self);
+    return state;
+}
+
+// A preempted thread only gives way to threads at least as urgent, any
+// other yield lets the next thread run whatever its level
+static int yield_thread(thread * self, bool preempted) {
+    worker * w = this_worker();
+    check_cancel(self);
+    // A tick means a whole quantum went by, a good time to catch up too
+    if(preempted || w->switches % REACTOR_POLL_INTERVAL == 0){
+        if(atomic_load_explicit(&io_waiters, memory_order_relaxed) > 0) reactor_poll(w, 0);
+        timers_run(w);
+    }
+    int max_level = PRIORITY_LOWEST;
+    if(preempted){
+        // It used up its quantum, under the MLFQ that costs it a level
+        if(sched_policy == WUT_SCHED_MLFQ && self->level < PRIORITY_LOWEST) self->level++;
+        max_level = self->level;
+    }
+    thread * next = dequeue_upto(w, max_level);
+    if(next == NULL) return -1;
+
+    if(DEBUG){
+        printf("\nYield thread %d\n", self->id);
+        print_queue();
+    }
+
+    w->requeue_prev = true;
+    switch_to(w, next);
+    check_cancel(self);
+    return 0;
+}
+
+// The Correct Way to Exit The Thread
+// 1. 在exit和cancel中，删除thread除了status之外的所有信息
+// 2. 如果有其他thread想join这个thread，那就在join结束后，删除status信息
+// 3. 如果没有其他thread想join这个thread，那就在检查TCB Array时，怕断所哟欧status大于0的Entry为可以使用的Entry，并覆盖该Entry对的信息
+int wut_cancel(int id) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = cancel_thread(self, id);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_join(int id) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = join_thread(self, id, -1);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_join_timeout(int id, long ns) {
+    if(ns < 0) ns = 0;
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = join_thread(self, id, ns);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_sleep_ns(long ns) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    worker * w = this_worker();
+    spin_lock(&wut_lock);
+    if(atomic_load(&self->cancel_pending)){
+        spin_unlock(&wut_lock);
+        wut_exit(128);
+    }
+    self->state = -4;
+    timer_add(self, ns < 0 ? 0 : ns);
+    leave_runnable();
+    w->unlock_prev = true;
+    switch_to(w, pick_next(w));
+    self->timed_out = false;
+    check_cancel(self);
+    preempt_enable(self);
+    return 0;
+}
+
+int wut_yield() {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = yield_thread(self, false);
+    preempt_enable(self);
+    return result;
+}
+
+// A tick caught `self` running
+static void preempt_yield(thread * self) {
+    preempt_disable(self);
+    yield_thread(self, true);
+    preempt_enable(self);
+}
+
+void wut_exit(int status) {
+    thread * self = this_thread();
+    run_destructors(self);
+    // Destructors may yield, and so may a preemption until it's disabled,
+    // so only then is the worker looked up
+    preempt_disable(self);
+    worker * w = this_worker();
+    spin_lock(&wut_lock);
+    if(atomic_load(&self->cancel_pending)) status = 128;
+    status &= 0xFF;
+    self->state = status;
+
+    if(DEBUG){
+        printf("\nExit Thread %d\n", self->id);
+        print_threads();
+        print_queue();
+    }
+
+    thread_exited(w, self);
+    leave_runnable();
+
+    // Straight on to the next thread, which frees our stack once we're off
+    // it and only then lets go of wut_lock, so the joiner can't collect us
+    // before that
+    w->retire_prev = true;
+    w->unlock_prev = true;
+    switch_to(w, pick_next(w));
+}
+
+void wut_set_cache_limit(int limit) {
+    if(limit < 0) limit = 0;
+    // May be called before wut_init
+    thread * self = this_thread();
+    if(self != NULL) preempt_disable(self);
+    spin_lock(&cache_lock);
+    cache_limit = limit;
+    for(int i = 0; i < STACK_CLASSES && stack_cache_count > cache_limit; i++){
+        while(stack_cache[i] != NULL && stack_cache_count > cache_limit){
+            cached_stack* cached = stack_cache[i];
+            stack_cache[i] = cached->next;
+            stack_cache_count--;
+            stack st = cached->st;
+            delete_stack(&st);
+        }
+    }
+    while(thread_cache_count > cache_limit){
+        thread * th = thread_cache;
+        thread_cache = th->next_free;
+        thread_cache_count--;
+        free(th->ent);
+        free(th);
+    }
+    spin_unlock(&cache_lock);
+    if(self != NULL) preempt_enable(self);
+}
+
+ssize_t wut_read(int fd, void * buf, size_t count) {
+    while(1){
+        ssize_t n = read(fd, buf, count);
+        if(n >= 0 || !would_block()) return n;
+        if(wait_fd(fd, EPOLLIN) < 0) return -1;
+    }
+}
+
+ssize_t wut_write(int fd, const void * buf, size_t count) {
+    while(1){
+        ssize_t n = write(fd, buf, count);
+        if(n >= 0 || !would_block()) return n;
+        if(wait_fd(fd, EPOLLOUT) < 0) return -1;
+    }
+}
+
+int wut_accept(int fd, struct sockaddr * addr, socklen_t * addrlen) {
+    while(1){
+        int client = accept(fd, addr, addrlen);
+        if(client >= 0){
+            int flags = fcntl(client, F_GETFL);
+            if(flags == -1 || fcntl(client, F_SETFL, flags | O_NONBLOCK) == -1){
+                close(client);
+                return -1;
+            }
+            return client;
+        }
+        if(!would_block()) return -1;
+        if(wait_fd(fd, EPOLLIN) < 0) return -1;
+    }
+}
+
+int wut_poll(int fd, int events) {
+    struct pollfd pfd = { .fd = fd, .events = (short) events, .revents = 0 };
+    if(poll(&pfd, 1, 0) > 0) return pfd.revents;
+    // The poll/epoll event bits have the same values
+    return wait_fd(fd, (uint32_t) events);
+}
+
+int wut_set_quantum(long usec) {
+    if(usec < 0) return -1;
+    preempt_quantum = usec;
+    if(workers != NULL) arm_timers();
+    return 0;
+}
+
+void wut_preempt_disable(void) {
+    preempt_disable(this_thread());
+}
+
+void wut_preempt_enable(void) {
+    preempt_enable(this_thread());
+}
+
+int wut_mutex_init(wut_mutex * mutex) {
+    struct mutex * m = (struct mutex*) mutex;
+    atomic_init(&m->state, 0);
+    m->owner = -1;
+    m->waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_mutex_lock(wut_mutex * mutex) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = mutex_lock((struct mutex*) mutex, self);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_mutex_trylock(wut_mutex * mutex) {
+    struct mutex * m = (struct mutex*) mutex;
+    thread * self = this_thread();
+    int unlocked = 0;
+    if(!atomic_compare_exchange_strong(&m->state, &unlocked, 1)){
+        errno = EBUSY;
+        return -1;
+    }
+    m->owner = self->id;
+    return 0;
+}
+
+int wut_mutex_unlock(wut_mutex * mutex) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = mutex_unlock((struct mutex*) mutex, self);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_cond_init(wut_cond * cond) {
+    ((struct cond*) cond)->waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_cond_wait(wut_cond * cond, wut_mutex * mutex) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = cond_wait((struct cond*) cond, (struct mutex*) mutex, self, -1);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_cond_wait_timeout(wut_cond * cond, wut_mutex * mutex, long ns) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = cond_wait((struct cond*) cond, (struct mutex*) mutex, self, ns < 0 ? 0 : ns);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_cond_signal(wut_cond * cond) {
+    struct cond * c = (struct cond*) cond;
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    if(c->waiters.head != NULL) cond_wake_one(c);
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return 0;
+}
+
+int wut_cond_broadcast(wut_cond * cond) {
+    struct cond * c = (struct cond*) cond;
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    while(c->waiters.head != NULL) cond_wake_one(c);
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return 0;
+}
+
+int wut_sem_init(wut_sem * sem, unsigned value) {
+    struct sem * s = (struct sem*) sem;
+    atomic_init(&s->count, value);
+    s->waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_sem_wait(wut_sem * sem) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = sem_wait((struct sem*) sem, self);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_sem_post(wut_sem * sem) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = sem_post((struct sem*) sem);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_waitgroup_init(wut_waitgroup * wg) {
+    waitgroup * g = (waitgroup*) wg;
+    atomic_init(&g->count, 0);
+    g->waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_waitgroup_add(wut_waitgroup * wg, long delta) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = waitgroup_add((waitgroup*) wg, delta);
+    preempt_enable(self);
+    if(result < 0) errno = EINVAL;
+    return result;
+}
+
+int wut_waitgroup_done(wut_waitgroup * wg) {
+    return wut_waitgroup_add(wg, -1);
+}
+
+int wut_waitgroup_wait(wut_waitgroup * wg) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = waitgroup_wait((waitgroup*) wg, self);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_rwlock_init(wut_rwlock * rwlock) {
+    struct rwlock * rw = (struct rwlock*) rwlock;
+    rw->readers = 0;
+    rw->waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_rwlock_rdlock(wut_rwlock * rwlock) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = rwlock_lock((struct rwlock*) rwlock, self, RWLOCK_READ);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_rwlock_wrlock(wut_rwlock * rwlock) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = rwlock_lock((struct rwlock*) rwlock, self, RWLOCK_WRITE);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_rwlock_unlock(wut_rwlock * rwlock) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = rwlock_unlock((struct rwlock*) rwlock);
+    preempt_enable(self);
+    return result;
+}
+
+wut_chan * wut_chan_create(size_t elem_size, long capacity) {
+    if(elem_size == 0 || capacity < WUT_CHAN_UNBOUNDED){
+        errno = EINVAL;
+        return NULL;
+    }
+    wut_chan * c = malloc(sizeof (wut_chan));
+    if(c == NULL) return NULL;
+    c->elem_size = elem_size;
+    c->capacity = capacity;
+    c->closed = false;
+    c->head = 0;
+    c->count = 0;
+    c->size = capacity == WUT_CHAN_UNBOUNDED ? CHAN_INITIAL_SIZE : (size_t) capacity;
+    c->buf = NULL;
+    if(c->size > 0){
+        c->buf = malloc(c->size * elem_size);
+        if(c->buf == NULL){
+            free(c);
+            return NULL;
+        }
+    }
+    TAILQ_INIT(&c->senders);
+    TAILQ_INIT(&c->receivers);
+    return c;
+}
+
+int wut_chan_send(wut_chan * chan, const void * elem) {
+    wut_chan_case cs = { chan, WUT_CHAN_SEND, (void*) elem, 0 };
+    thread * self = this_thread();
+    preempt_disable(self);
+    int selected = chan_select(self, &cs, 1, true);
+    preempt_enable(self);
+    // A NULL channel fails before anything is sent, errno says why
+    if(selected < 0) return -1;
+    if(cs.result < 0) errno = EPIPE;
+    return cs.result;
+}
+
+int wut_chan_recv(wut_chan * chan, void * elem) {
+    wut_chan_case cs = { chan, WUT_CHAN_RECV, elem, 0 };
+    thread * self = this_thread();
+    preempt_disable(self);
+    int selected = chan_select(self, &cs, 1, true);
+    preempt_enable(self);
+    if(selected < 0) return -1;
+    return cs.result;
+}
+
+int wut_chan_close(wut_chan * chan) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    if(chan->closed){
+        spin_unlock(&wut_lock);
+        preempt_enable(self);
+        return -1;
+    }
+    chan->closed = true;
+    // Nothing is buffered while receivers wait, they all get -1. Senders
+    // can't send any more.
+    chan_node * node;
+    while((node = TAILQ_FIRST(&chan->receivers)) != NULL){
+        memset(node->elem, 0, chan->elem_size);
+        chan_wake(node, -1);
+    }
+    while((node = TAILQ_FIRST(&chan->senders)) != NULL){
+        chan_wake(node, -1);
+    }
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return 0;
+}
+
+void wut_chan_destroy(wut_chan * chan) {
+    free(chan->buf);
+    free(chan);
+}
+
+int wut_select(wut_chan_case * cases, int count, int block) {
+    if(count <= 0){
+        errno = EINVAL;
+        return -1;
+    }
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = chan_select(self, cases, count, block != 0);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_task_pool_start(int threads, long queue_size) {
+    if(threads < 1 || queue_size < 0){
+        errno = EINVAL;
+        return -1;
+    }
+    int stopped = TASK_POOL_STOPPED;
+    if(!atomic_compare_exchange_strong(&task_pool_state, &stopped, TASK_POOL_STARTING)){
+        errno = EBUSY;
+        return -1;
+    }
+    task_chan = wut_chan_create(sizeof (task), queue_size);
+    int created = 0;
+    while(task_chan != NULL && created < threads && wut_create(task_thread) >= 0){
+        created++;
+    }
+    if(created == 0){
+        if(task_chan != NULL) wut_chan_destroy(task_chan);
+        task_chan = NULL;
+        atomic_store(&task_pool_state, TASK_POOL_STOPPED);
+        errno = ENOMEM;
+        return -1;
+    }
+    atomic_store_explicit(&task_pool_state, TASK_POOL_RUNNING, memory_order_release);
+    return 0;
+}
+
+int wut_spawn_task(void (*fn)(void *), void * arg, wut_waitgroup * wg) {
+    if(atomic_load_explicit(&task_pool_state, memory_order_acquire) != TASK_POOL_RUNNING){
+        wut_task_pool_start(TASK_THREADS_PER_WORKER * workers_count, TASK_QUEUE_DEFAULT);
+        // Someone else may be starting it
+        while(atomic_load_explicit(&task_pool_state, memory_order_acquire) == TASK_POOL_STARTING){
+            wut_yield();
+        }
+        if(atomic_load(&task_pool_state) != TASK_POOL_RUNNING) return -1;
+    }
+    if(wg != NULL) wut_waitgroup_add(wg, 1);
+    task t = { fn, arg, wg };
+    if(wut_chan_send(task_chan, &t) < 0){
+        if(wg != NULL) wut_waitgroup_done(wg);
+        return -1;
+    }
+    return 0;
+}
+
+int wut_group_init(wut_group * group) {
+    struct group * g = (struct group*) group;
+    g->members = 0;
+    g->exited_count = 0;
+    g->exited = NULL;
+    g->any_waiters = (waitq){ NULL, NULL };
+    g->all_waiters = (waitq){ NULL, NULL };
+    return 0;
+}
+
+int wut_join_any(wut_group * group, int * status) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = join_any((struct group*) group, self, status);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_group_wait(wut_group * group) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    int result = group_wait((struct group*) group, self);
+    preempt_enable(self);
+    return result;
+}
+
+int wut_key_create(wut_key * key, void (*destructor)(void *)) {
+    // May be called before wut_init
+    thread * self = this_thread();
+    if(self != NULL) preempt_disable(self);
+    spin_lock(&wut_lock);
+    int count = atomic_load_explicit(&keys_count, memory_order_relaxed);
+    if(count < WUT_KEYS_MAX){
+        key_destructors[count] = destructor;
+        // Exiting threads read the count without the lock
+        atomic_store_explicit(&keys_count, count + 1, memory_order_release);
+    }
+    spin_unlock(&wut_lock);
+    if(self != NULL) preempt_enable(self);
+    if(count == WUT_KEYS_MAX){
+        errno = EAGAIN;
+        return -1;
+    }
+    *key = count;
+    return 0;
+}
+
+void * wut_getspecific(wut_key key) {
+    if((unsigned) key >= WUT_KEYS_MAX) return NULL;
+    return this_thread()->specific[key];
+}
+
+int wut_setspecific(wut_key key, const void * value) {
+    if((unsigned) key >= (unsigned) atomic_load_explicit(&keys_count, memory_order_relaxed)){
+        errno = EINVAL;
+        return -1;
+    }
+    this_thread()->specific[key] = (void*) value;
+    return 0;
+}
+
+int wut_set_priority(int id, int priority) {
+    if(priority < 0 || priority >= PRIORITY_LEVELS) return -1;
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    if(id < 0 || id >= threads_capacity || threads[id] == NULL || threads[id]->state >= 0){
+        spin_unlock(&wut_lock);
+        preempt_enable(self);
+        return -1;
+    }
+    thread * th = threads[id];
+    th->priority = priority;
+    // Only a queued thread has to move, the others use it next time
+    // they're queued
+    bool queued = dequeue_thread(th);
+    th->level = priority;
+    if(queued) enqueue(this_worker(), th);
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return 0;
+}
+
+int wut_get_priority(int id) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    int priority = -1;
+    if(id >= 0 && id < threads_capacity && threads[id] != NULL) priority = threads[id]->priority;
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return priority;
+}
+
+int wut_set_policy(int policy) {
+    if(policy != WUT_SCHED_PRIORITY && policy != WUT_SCHED_MLFQ) return -1;
+    sched_policy = policy;
+    return 0;
+}
+
+int wut_trace_start(size_t events) {
+    if(workers == NULL || tracing) return -1;
+    size_t size = 1;
+    while(size < events) size <<= 1;
+    // The rings are only ever allocated once, a worker could still be
+    // writing into them
+    if(events > 0 && trace_size == 0){
+        for(int i = 0; i < workers_count; i++){
+            workers[i].trace = calloc(size, sizeof (trace_event));
+            if(workers[i].trace == NULL) die("trace calloc");
+        }
+        trace_size = size;
+    }
+    else if(events > 0 && size != trace_size){
+        return -1;
+    }
+    for(int i = 0; i < workers_count; i++){
+        workers[i].trace_next = 0;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    trace_start_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    trace_start_ticks = trace_clock();
+    // The running thread started just now as far as accounting goes
+    this_thread()->run_start = trace_start_ticks;
+    atomic_thread_fence(memory_order_seq_cst);
+    tracing = true;
+    return 0;
+}
+
+void wut_trace_stop(void) {
+    tracing = false;
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+int wut_get_stats(int id, wut_stats * stats) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    spin_lock(&wut_lock);
+    if(id < 0 || id >= threads_capacity || threads[id] == NULL){
+        spin_unlock(&wut_lock);
+        preempt_enable(self);
+        return -1;
+    }
+    thread * th = threads[id];
+    uint64_t cpu = th->cpu_ticks;
+    // Our own slice isn't over yet
+    if(th == self && tracing) cpu += trace_clock() - th->run_start;
+    double rate = trace_ticks_per_ns();
+    stats->cpu_ns = (unsigned long long) (cpu / rate);
+    stats->runnable_ns = (unsigned long long) (th->runnable_ticks / rate);
+    stats->switches = th->run_count;
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return 0;
+}
+
+// One track per worker. Each stretch a thread runs is a slice named after
+// it, and blocking, waking, creating and exiting show up as instant events.
+int wut_trace_dump(const char * path) {
+    if(trace_size == 0) return -1;
+    FILE * out = fopen(path, "w");
+    if(out == NULL) return -1;
+    double rate = trace_ticks_per_ns();
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char * sep = "";
+    for(int i = 0; i < workers_count; i++){
+        worker * w = &workers[i];
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}", sep, i, i);
+        sep = ",\n";
+        uint64_t first = w->trace_next > trace_size ? w->trace_next - trace_size : 0;
+        int running = -2; // not known until the first switch
+        double running_since = 0;
+        for(uint64_t n = first; n < w->trace_next; n++){
+            trace_event * ev = &w->trace[n & (trace_size - 1)];
+            // Microseconds since wut_trace_start
+            double ts = ev->time < trace_start_ticks ? 0 : (ev->time - trace_start_ticks) / rate / 1000;
+            if(ev->type == TRACE_CREATE){
+                fprintf(out, "%s{\"name\":\"create %d\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", sep, ev->id, i, ts);
+            }
+            else if(ev->type == TRACE_WAKE){
+                fprintf(out, "%s{\"name\":\"wake %d\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", sep, ev->id, i, ts);
+            }
+            else{
+                if(running >= 0 && running == ev->id){
+                    fprintf(out, "%s{\"name\":\"thread %d\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", sep, running, i, running_since, ts - running_since);
+                }
+                if(ev->id >= 0 && ev->state != -1){
+                    if(ev->state >= 0){
+                        fprintf(out, "%s{\"name\":\"exit %d\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"status\":%d}}", sep, ev->id, i, ts, ev->state);
+                    }
+                    else{
+                        fprintf(out, "%s{\"name\":\"block %d\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"on\":\"%s\"}}", sep, ev->id, i, ts, trace_state_name(ev->state));
+                    }
+                }
+                running = ev->other;
+                running_since = ts;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+int wut_stack_usage_start(int fd) {
+    stack_usage_fd = fd;
+    atomic_store(&stack_usage, true);
+    return 0;
+}
+
+void wut_stack_usage_stop(void) {
+    atomic_store(&stack_usage, false);
+}
+
+int wut_get_stack_histogram(wut_stack_histogram * hist) {
+    hist->threads = atomic_load(&stack_usage_threads);
+    hist->max = atomic_load(&stack_usage_max);
+    for(int i = 0; i < WUT_STACK_BUCKETS; i++){
+        hist->buckets[i] = atomic_load(&stack_usage_buckets[i]);
+    }
+    return 0;
+}
+
+long wut_stack_peak(int id) {
+    thread * self = this_thread();
+    preempt_disable(self);
+    // An exiting thread only lets go of wut_lock once its stack is retired
+    spin_lock(&wut_lock);
+    long peak = -1;
+    if(id >= 0 && id < threads_capacity && threads[id] != NULL){
+        thread * th = threads[id];
+        if(th->state >= 0) peak = th->stack_peak;
+        else if(th->stack.base != NULL) peak = stack_used(&th->stack);
+    }
+    spin_unlock(&wut_lock);
+    preempt_enable(self);
+    return peak;
 }
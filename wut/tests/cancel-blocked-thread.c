@@ -0,0 +1,43 @@
+#include "test.h"
+
+#include "wut.h"
+
+void t2_run(void) {
+    wut_yield();
+    wut_exit(7);
+}
+
+void t1_run(void) {
+    shared_memory[1] = wut_create(t2_run);
+    shared_memory[2] = wut_join(shared_memory[1]);
+}
+
+void test(void) {
+    wut_init();
+    shared_memory[0] = wut_create(t1_run);
+    wut_yield();
+    shared_memory[3] = wut_cancel(shared_memory[0]);
+    shared_memory[4] = wut_join(shared_memory[1]);
+    shared_memory[5] = wut_join(shared_memory[0]);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 1, "wut_id of the first thread is wrong"
+    );
+    expect(
+        shared_memory[1], 2, "wut_id of the second thread is wrong"
+    );
+    expect(
+        shared_memory[2], TEST_MAGIC, "a cancelled thread's join should never return"
+    );
+    expect(
+        shared_memory[3], 0, "cancelling a blocked thread should be successful"
+    );
+    expect(
+        shared_memory[4], 7, "the cancelled thread's join target should be joinable"
+    );
+    expect(
+        shared_memory[5], 128, "thread 1 got cancelled, status should be 128"
+    );
+}
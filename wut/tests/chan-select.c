@@ -0,0 +1,99 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define ROUNDS 50
+
+static wut_chan * numbers;
+static wut_chan * words;
+static wut_chan * quit;
+
+void numbers_run(void) {
+    for (int i = 0; i < ROUNDS; ++i) {
+        wut_chan_send(numbers, &i);
+    }
+}
+
+void words_run(void) {
+    for (int i = 0; i < ROUNDS; ++i) {
+        int word = 1000 + i;
+        wut_chan_send(words, &word);
+    }
+    int done = 1;
+    wut_chan_send(quit, &done);
+}
+
+void test(void) {
+    wut_init();
+    numbers = wut_chan_create(sizeof(int), 0);
+    words = wut_chan_create(sizeof(int), 0);
+    quit = wut_chan_create(sizeof(int), 0);
+
+    // Nothing is ready yet
+    int value;
+    wut_chan_case cases[3] = {
+        { numbers, WUT_CHAN_RECV, &value, 0 },
+        { words, WUT_CHAN_RECV, &value, 0 },
+        { quit, WUT_CHAN_RECV, &value, 0 },
+    };
+    shared_memory[0] = wut_select(cases, 3, 0);
+
+    wut_create(numbers_run);
+    wut_create(words_run);
+    int got[3] = { 0, 0, 0 };
+    int wrong = 0;
+    while (got[0] < ROUNDS || got[2] == 0) {
+        int index = wut_select(cases, 3, 1);
+        ++got[index];
+        if (index == 0 && value >= 1000) ++wrong;
+        if (index == 1 && value < 1000) ++wrong;
+        // Once the numbers are done, stop listening to them
+        if (got[0] == ROUNDS) cases[0].chan = NULL;
+    }
+    shared_memory[1] = got[0];
+    shared_memory[2] = got[1];
+    shared_memory[3] = wrong;
+
+    // A send case goes ahead as soon as a receiver shows up
+    wut_chan * buffered = wut_chan_create(sizeof(int), 1);
+    int one = 1;
+    wut_chan_case send = { buffered, WUT_CHAN_SEND, &one, -1 };
+    shared_memory[4] = wut_select(&send, 1, 0);
+    shared_memory[5] = wut_select(&send, 1, 0);
+    wut_chan_close(buffered);
+    wut_chan_case recv[2] = {
+        { NULL, WUT_CHAN_RECV, &value, 0 },
+        { buffered, WUT_CHAN_RECV, &value, 0 },
+    };
+    wut_select(recv, 2, 1);
+    shared_memory[6] = recv[1].result == 0 && value == 1;
+    wut_select(recv, 2, 1);
+    shared_memory[7] = recv[1].result;
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], -1, "a non-blocking select with nothing ready should fail"
+    );
+    expect(
+        shared_memory[1], ROUNDS, "every number should be received"
+    );
+    expect(
+        shared_memory[2], ROUNDS, "every word should be received"
+    );
+    expect(
+        shared_memory[3], 0, "each value should come from its own channel"
+    );
+    expect(
+        shared_memory[4], 0, "the first send should fit in the buffer"
+    );
+    expect(
+        shared_memory[5], -1, "the second send should find the buffer full"
+    );
+    expect(
+        shared_memory[6], 1, "a closed channel should still hand out its buffer"
+    );
+    expect(
+        shared_memory[7], -1, "a drained closed channel should be ready with -1"
+    );
+}
@@ -0,0 +1,113 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <errno.h> // errno, EINVAL
+
+#define ITEMS 100
+
+static wut_chan * unbuffered;
+static wut_chan * bounded;
+static int received_in_order = 1;
+static long received_sum;
+
+void sender_run(void) {
+    for (int i = 0; i < ITEMS; ++i) {
+        wut_chan_send(unbuffered, &i);
+    }
+    wut_chan_close(unbuffered);
+}
+
+void receiver_run(void) {
+    int value;
+    int expected = 0;
+    while (wut_chan_recv(bounded, &value) == 0) {
+        if (value != expected++) {
+            received_in_order = 0;
+        }
+        received_sum += value;
+    }
+}
+
+void test(void) {
+    wut_init();
+    unbuffered = wut_chan_create(sizeof(int), 0);
+    bounded = wut_chan_create(sizeof(int), 4);
+
+    // Pass everything from the unbuffered channel on through the bounded one
+    int sender = wut_create(sender_run);
+    int receiver = wut_create(receiver_run);
+    int value;
+    int forwarded = 0;
+    while (wut_chan_recv(unbuffered, &value) == 0) {
+        wut_chan_send(bounded, &value);
+        ++forwarded;
+    }
+    wut_chan_close(bounded);
+    wut_join(sender);
+    wut_join(receiver);
+    shared_memory[0] = forwarded;
+    shared_memory[1] = received_in_order;
+    shared_memory[2] = received_sum == (long) ITEMS * (ITEMS - 1) / 2;
+    shared_memory[3] = wut_chan_send(bounded, &value);
+    shared_memory[4] = wut_chan_close(bounded);
+
+    // An unbounded channel never makes the sender wait
+    wut_chan * unbounded = wut_chan_create(sizeof(long), WUT_CHAN_UNBOUNDED);
+    for (long i = 0; i < 1000; ++i) {
+        wut_chan_send(unbounded, &i);
+    }
+    wut_chan_close(unbounded);
+    long big;
+    long sum = 0;
+    int count = 0;
+    while (wut_chan_recv(unbounded, &big) == 0) {
+        sum += big;
+        ++count;
+    }
+    shared_memory[5] = count;
+    shared_memory[6] = sum == 1000L * 999 / 2;
+
+    wut_chan_destroy(unbuffered);
+    wut_chan_destroy(bounded);
+    wut_chan_destroy(unbounded);
+
+    // Nothing to send on or receive from
+    value = 1;
+    shared_memory[7] = wut_chan_send(NULL, &value);
+    shared_memory[8] = errno;
+    shared_memory[9] = wut_chan_recv(NULL, &value);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], ITEMS, "every item should come through the unbuffered channel"
+    );
+    expect(
+        shared_memory[1], 1, "items should arrive in the order they were sent"
+    );
+    expect(
+        shared_memory[2], 1, "every item should arrive exactly once"
+    );
+    expect(
+        shared_memory[3], -1, "sending on a closed channel should fail"
+    );
+    expect(
+        shared_memory[4], -1, "closing a channel twice should fail"
+    );
+    expect(
+        shared_memory[5], 1000, "a closed channel should still hand out what it buffered"
+    );
+    expect(
+        shared_memory[6], 1, "the unbounded channel should keep every element"
+    );
+    expect(
+        shared_memory[7], -1, "sending on no channel should fail"
+    );
+    expect(
+        shared_memory[8], EINVAL, "sending on no channel should set EINVAL"
+    );
+    expect(
+        shared_memory[9], -1, "receiving from no channel should fail"
+    );
+}
@@ -0,0 +1,113 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <errno.h> // errno, ETIMEDOUT
+#include <time.h> // clock_gettime
+
+#define MS 1000000L
+
+static wut_mutex mutex;
+static wut_cond cond;
+
+static long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / MS;
+}
+
+void late_signal_run(void) {
+    wut_sleep_ns(5 * MS);
+    wut_mutex_lock(&mutex);
+    wut_cond_signal(&cond);
+    wut_mutex_unlock(&mutex);
+}
+
+void holder_run(void) {
+    wut_mutex_lock(&mutex);
+    wut_sleep_ns(30 * MS);
+    wut_mutex_unlock(&mutex);
+}
+
+void signal_and_hold_run(void) {
+    wut_mutex_lock(&mutex);
+    wut_cond_signal(&cond);
+    wut_sleep_ns(20 * MS);
+    wut_mutex_unlock(&mutex);
+}
+
+void test(void) {
+    struct timespec start;
+    wut_init();
+    wut_mutex_init(&mutex);
+    wut_cond_init(&cond);
+
+    // Nobody signals
+    wut_mutex_lock(&mutex);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    shared_memory[0] = wut_cond_wait_timeout(&cond, &mutex, 10 * MS);
+    shared_memory[1] = errno;
+    shared_memory[2] = elapsed_ms(&start) >= 10;
+    shared_memory[3] = wut_mutex_unlock(&mutex);
+
+    // Signalled in time
+    wut_mutex_lock(&mutex);
+    int id = wut_create(late_signal_run);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    shared_memory[4] = wut_cond_wait_timeout(&cond, &mutex, 1000 * MS);
+    shared_memory[5] = elapsed_ms(&start) < 500;
+    wut_mutex_unlock(&mutex);
+    wut_join(id);
+
+    // Timed out, but the mutex is only free again later
+    wut_mutex_lock(&mutex);
+    id = wut_create(holder_run);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    shared_memory[6] = wut_cond_wait_timeout(&cond, &mutex, 10 * MS);
+    shared_memory[7] = elapsed_ms(&start) >= 30;
+    shared_memory[8] = wut_mutex_unlock(&mutex);
+    wut_join(id);
+
+    // Signalled in time, then waiting for the mutex past the timeout
+    wut_mutex_lock(&mutex);
+    id = wut_create(signal_and_hold_run);
+    shared_memory[9] = wut_cond_wait_timeout(&cond, &mutex, 5 * MS);
+    shared_memory[10] = wut_mutex_unlock(&mutex);
+    wut_join(id);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], -1, "a wait nobody signals should time out"
+    );
+    expect(
+        shared_memory[1], ETIMEDOUT, "a timed out wait should set ETIMEDOUT"
+    );
+    expect(
+        shared_memory[2], 1, "a timed out wait shouldn't end early"
+    );
+    expect(
+        shared_memory[3], 0, "a timed out wait should hold the mutex again"
+    );
+    expect(
+        shared_memory[4], 0, "a signalled wait should succeed"
+    );
+    expect(
+        shared_memory[5], 1, "a signalled wait shouldn't wait for its timeout"
+    );
+    expect(
+        shared_memory[6], -1, "the wait should time out while the mutex is held"
+    );
+    expect(
+        shared_memory[7], 1, "a timed out wait should wait for the mutex"
+    );
+    expect(
+        shared_memory[8], 0, "the waiter should hold the mutex once it returns"
+    );
+    expect(
+        shared_memory[9], 0, "a wait signalled in time shouldn't time out"
+    );
+    expect(
+        shared_memory[10], 0, "the signalled waiter should hold the mutex"
+    );
+}
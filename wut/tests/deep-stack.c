@@ -0,0 +1,42 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define FRAME_SIZE 4096
+#define DEPTH 200 // 800 KiB, far more than the default stack
+
+static int recurse(int depth) {
+    volatile char frame[FRAME_SIZE];
+    frame[0] = (char) depth;
+    frame[FRAME_SIZE - 1] = (char) depth;
+    if (depth == 0) {
+        return frame[0] + frame[FRAME_SIZE - 1];
+    }
+    return recurse(depth - 1) + 1 + frame[0] - frame[FRAME_SIZE - 1];
+}
+
+void run(void) {
+    shared_memory[2] = recurse(DEPTH);
+    wut_exit(3);
+}
+
+void test(void) {
+    wut_init();
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.stack_size = 1024 * 1024;
+    shared_memory[0] = wut_create_ex(run, &attr);
+    shared_memory[1] = wut_join(shared_memory[0]);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 1, "wut_create_ex should return id 1"
+    );
+    expect(
+        shared_memory[1], 3, "thread with a large stack should exit normally"
+    );
+    expect(
+        shared_memory[2], DEPTH, "recursion should complete"
+    );
+}
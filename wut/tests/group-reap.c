@@ -0,0 +1,62 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define CHILDREN 1000
+
+static int ran;
+
+void child_run(void) {
+    ++ran;
+    wut_yield();
+    wut_exit(wut_id() % 7);
+}
+
+void test(void) {
+    wut_init();
+    wut_group group;
+    wut_group_init(&group);
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.group = &group;
+
+    int first = wut_create_ex(child_run, &attr);
+    shared_memory[0] = wut_join(first);
+    int status = -1;
+    int id = wut_join_any(&group, &status);
+    shared_memory[1] = id == first && status == first % 7;
+    shared_memory[2] = wut_join_any(&group, &status);
+
+    for (int i = 0; i < CHILDREN; ++i) {
+        wut_create_ex(child_run, &attr);
+    }
+    shared_memory[3] = wut_group_wait(&group);
+    shared_memory[4] = ran;
+    shared_memory[5] = wut_group_wait(&group);
+    // The IDs were all freed
+    shared_memory[6] = wut_create(child_run) == 1;
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], -1, "wut_join on a group member should fail"
+    );
+    expect(
+        shared_memory[1], 1, "wut_join_any should reap the exited member"
+    );
+    expect(
+        shared_memory[2], -1, "wut_join_any on an empty group should fail"
+    );
+    expect(
+        shared_memory[3], CHILDREN, "wut_group_wait should reap every member"
+    );
+    expect(
+        shared_memory[4], CHILDREN + 1, "every member should have run"
+    );
+    expect(
+        shared_memory[5], 0, "an empty group has nothing to wait for"
+    );
+    expect(
+        shared_memory[6], 1, "reaped threads should give their IDs back"
+    );
+}
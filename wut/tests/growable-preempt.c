@@ -0,0 +1,62 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <stdatomic.h> // atomic_int
+
+#define FRAME_SIZE (16 * 1024)
+#define SPINS (100 * 1000 * 1000)
+
+static atomic_int stop;
+
+// Spins without calling anything, so nothing below its page aligned frame
+// is ever made accessible. A tick delivered here would have no room for its
+// signal frame.
+static __attribute__((noinline)) int spin_deep(void) {
+    volatile char frame[FRAME_SIZE] __attribute__((aligned(4096)));
+    frame[0] = 1;
+    frame[FRAME_SIZE - 1] = 1;
+    for (int i = 0; i < SPINS; ++i) {
+        frame[0] = (char) i;
+    }
+    return frame[0] + frame[FRAME_SIZE - 1];
+}
+
+void growable_run(void) {
+    shared_memory[2] = spin_deep();
+}
+
+void spin_run(void) {
+    while (!atomic_load(&stop)) {
+    }
+}
+
+void test(void) {
+    shared_memory[0] = wut_set_quantum(1000);
+    wut_init();
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.growable = 1;
+    shared_memory[1] = wut_join(wut_create_ex(growable_run, &attr));
+
+    // Threads without a growable stack are still preempted
+    int id = wut_create(spin_run);
+    wut_yield();
+    atomic_store(&stop, 1);
+    shared_memory[3] = wut_join(id);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_set_quantum should be successful"
+    );
+    expect(
+        shared_memory[1], 0, "a growable thread should survive preemption ticks"
+    );
+    expect(
+        shared_memory[2], (char) (SPINS - 1) + 1, "the growable thread should finish spinning"
+    );
+    expect(
+        shared_memory[3], 0, "a spinning thread should still be preempted"
+    );
+}
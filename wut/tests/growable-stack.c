@@ -0,0 +1,131 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <signal.h> // SIGABRT, sigaction
+#include <string.h> // memset
+#include <sys/mman.h> // mmap, mprotect
+#include <sys/wait.h> // waitpid
+#include <unistd.h> // fork
+
+#define FRAME_SIZE 4096
+#define DEPTH 200 // 800 KiB, grown from a single page
+#define KiB 1024
+
+static int recurse(int depth) {
+    volatile char frame[FRAME_SIZE];
+    frame[0] = (char) depth;
+    frame[FRAME_SIZE - 1] = (char) depth;
+    if (depth == 0) {
+        return frame[0] + frame[FRAME_SIZE - 1];
+    }
+    return recurse(depth - 1) + 1 + frame[0] - frame[FRAME_SIZE - 1];
+}
+
+static int peak;
+static char * foreign_page;
+static int foreign_faults;
+
+// The application's own handler, it's still called for faults that aren't
+// on a growable stack
+void foreign_handler(int sig, siginfo_t * info, void * uc) {
+    (void) sig;
+    (void) uc;
+    if ((char*) info->si_addr == foreign_page) {
+        ++foreign_faults;
+        mprotect(foreign_page, 4096, PROT_READ | PROT_WRITE);
+    }
+}
+
+void shallow_run(void) {
+    recurse(2);
+}
+
+static void foreign_fault(void) {
+    mprotect(foreign_page, 4096, PROT_NONE);
+    *(volatile char*) foreign_page = 1;
+}
+
+void run(void) {
+    shared_memory[1] = recurse(DEPTH);
+    peak = (int) (wut_stack_peak(wut_id()) / KiB);
+}
+
+void test(void) {
+    // Overflowing a growable stack aborts
+    pid_t pid = fork();
+    if (pid == 0) {
+        wut_init();
+        wut_attr attr;
+        wut_attr_init(&attr);
+        attr.stack_size = 64 * KiB;
+        attr.growable = 1;
+        wut_join(wut_create_ex(run, &attr));
+        exit(0);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    shared_memory[0] = WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGABRT;
+
+    // Without a handler of the application's, any other fault still kills
+    pid = fork();
+    if (pid == 0) {
+        wut_init();
+        wut_attr attr;
+        wut_attr_init(&attr);
+        attr.growable = 1;
+        wut_join(wut_create_ex(shallow_run, &attr));
+        *(volatile char*) mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) = 1;
+        exit(0);
+    }
+    waitpid(pid, &wstatus, 0);
+    shared_memory[4] = WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGSEGV;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = foreign_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+    foreign_page = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    wut_init();
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.stack_size = 1024 * KiB;
+    attr.growable = 1;
+    shared_memory[2] = wut_join(wut_create_ex(run, &attr));
+    shared_memory[3] = peak >= DEPTH * FRAME_SIZE / KiB;
+
+    // Other faults go to the application's handler, and stacks still grow
+    // after one (a new size, so not from the cache)
+    foreign_fault();
+    attr.stack_size = 2048 * KiB;
+    shared_memory[6] = wut_join(wut_create_ex(run, &attr));
+    foreign_fault();
+    shared_memory[5] = foreign_faults;
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 1, "overflowing a growable stack should abort"
+    );
+    expect(
+        shared_memory[1], DEPTH, "recursion should complete"
+    );
+    expect(
+        shared_memory[2], 0, "thread with a growable stack should exit normally"
+    );
+    expect(
+        shared_memory[3], 1, "the stack should have grown to fit the recursion"
+    );
+    expect(
+        shared_memory[4], 1, "a fault off the growable stacks should still kill"
+    );
+    expect(
+        shared_memory[5], 2, "every other fault should go to the application's handler"
+    );
+    expect(
+        shared_memory[6], 0, "a stack should still grow after another fault"
+    );
+}
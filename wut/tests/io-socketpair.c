@@ -0,0 +1,54 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <sys/socket.h> // socketpair
+
+static int sv[2];
+
+void reader_run(void) {
+    char buf[8];
+    shared_memory[2] = 1;
+    shared_memory[3] = wut_read(sv[1], buf, sizeof(buf));
+    shared_memory[4] = buf[0];
+    wut_exit(2);
+}
+
+void test(void) {
+    shared_memory[0] = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    wut_init();
+    int id = wut_create(reader_run);
+    // The reader waits for data, so we get to run again
+    shared_memory[1] = wut_yield();
+    shared_memory[5] = shared_memory[3];
+    shared_memory[6] = wut_write(sv[0], "hi", 2);
+    // Nothing else is runnable, the join waits in the reactor
+    shared_memory[7] = wut_join(id);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "socketpair should be successful"
+    );
+    expect(
+        shared_memory[1], 0, "wut_yield should be successful"
+    );
+    expect(
+        shared_memory[2], 1, "the reader should have started"
+    );
+    expect(
+        shared_memory[5], TEST_MAGIC, "the read shouldn't finish before the write"
+    );
+    expect(
+        shared_memory[6], 2, "wut_write should write everything"
+    );
+    expect(
+        shared_memory[3], 2, "wut_read should read what was written"
+    );
+    expect(
+        shared_memory[4], 'h', "wut_read should read what was written"
+    );
+    expect(
+        shared_memory[7], 2, "the reader should exit after its read"
+    );
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define JOINERS 8
+
+static int target;
+static int statuses[JOINERS];
+
+void target_run(void) {
+    // Let every joiner block first
+    wut_sleep_ns(20 * 1000 * 1000);
+    wut_exit(42);
+}
+
+void joiner_run(void) {
+    statuses[wut_id() - target - 1] = wut_join(target);
+}
+
+void stuck_run(void) {
+    wut_join(target);
+}
+
+void test(void) {
+    wut_init();
+    target = wut_create(target_run);
+    int joiners[JOINERS];
+    for (int i = 0; i < JOINERS; ++i) {
+        joiners[i] = wut_create(joiner_run);
+    }
+    // A joiner that gets cancelled and one that gives up don't count
+    int stuck = wut_create(stuck_run);
+    wut_yield();
+    shared_memory[0] = wut_cancel(stuck);
+    shared_memory[1] = wut_join_timeout(target, 1000);
+
+    for (int i = 0; i < JOINERS; ++i) {
+        wut_join(joiners[i]);
+    }
+    int wrong = 0;
+    for (int i = 0; i < JOINERS; ++i) {
+        if (statuses[i] != 42) {
+            ++wrong;
+        }
+    }
+    shared_memory[2] = wrong;
+    // Everyone collected the status, the thread is gone
+    shared_memory[3] = wut_join(target);
+    shared_memory[4] = wut_join(stuck);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "cancelling a joiner should succeed"
+    );
+    expect(
+        shared_memory[1], -1, "a timed join should time out"
+    );
+    expect(
+        shared_memory[2], 0, "every joiner should get the exit status"
+    );
+    expect(
+        shared_memory[3], -1, "the thread should be gone once every joiner is done"
+    );
+    expect(
+        shared_memory[4], 128, "the cancelled joiner should still be joinable"
+    );
+}
@@ -0,0 +1,50 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <stdatomic.h> // atomic_int
+
+#define THREADS 64
+#define ROUNDS 100
+
+static atomic_int counter;
+
+void count_run(void) {
+    for (int i = 0; i < ROUNDS; ++i) {
+        atomic_fetch_add(&counter, 1);
+        wut_yield();
+    }
+    wut_exit(wut_id() % 256);
+}
+
+void test(void) {
+    shared_memory[0] = wut_init_workers(4);
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        ids[i] = wut_create(count_run);
+    }
+    int wrong = 0;
+    for (int i = 0; i < THREADS; ++i) {
+        if (wut_join(ids[i]) != ids[i] % 256) {
+            ++wrong;
+        }
+    }
+    shared_memory[1] = wrong;
+    shared_memory[2] = atomic_load(&counter);
+    shared_memory[3] = wut_id();
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_init_workers should be successful"
+    );
+    expect(
+        shared_memory[1], 0, "some joins returned the wrong status"
+    );
+    expect(
+        shared_memory[2], THREADS * ROUNDS, "every thread should run every round"
+    );
+    expect(
+        shared_memory[3], 0, "the main thread should still be thread 0"
+    );
+}
@@ -0,0 +1,104 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define ITEMS 2000
+#define SLOTS 4
+
+static wut_mutex mutex;
+static wut_cond not_empty;
+static wut_cond not_full;
+static int order[3];
+static int order_count;
+
+static int buffer[SLOTS];
+static int head;
+static int count;
+static long consumed;
+
+void locker_run(void) {
+    wut_mutex_lock(&mutex);
+    order[order_count++] = wut_id();
+    wut_mutex_unlock(&mutex);
+}
+
+void producer_run(void) {
+    for (int i = 1; i <= ITEMS; ++i) {
+        wut_mutex_lock(&mutex);
+        while (count == SLOTS) {
+            wut_cond_wait(&not_full, &mutex);
+        }
+        buffer[(head + count) % SLOTS] = i;
+        ++count;
+        wut_cond_signal(&not_empty);
+        wut_mutex_unlock(&mutex);
+    }
+}
+
+void consumer_run(void) {
+    for (int i = 0; i < ITEMS; ++i) {
+        wut_mutex_lock(&mutex);
+        while (count == 0) {
+            wut_cond_wait(&not_empty, &mutex);
+        }
+        consumed += buffer[head];
+        head = (head + 1) % SLOTS;
+        --count;
+        wut_cond_signal(&not_full);
+        wut_mutex_unlock(&mutex);
+    }
+}
+
+void test(void) {
+    wut_init();
+    wut_mutex_init(&mutex);
+    wut_cond_init(&not_empty);
+    wut_cond_init(&not_full);
+
+    // Everyone queues up on the mutex while we hold it, then gets it in order
+    wut_mutex_lock(&mutex);
+    int ids[3];
+    for (int i = 0; i < 3; ++i) {
+        ids[i] = wut_create(locker_run);
+    }
+    wut_yield();
+    shared_memory[0] = order_count;
+    shared_memory[1] = wut_mutex_unlock(&mutex);
+    for (int i = 0; i < 3; ++i) {
+        wut_join(ids[i]);
+    }
+    shared_memory[2] = order[0] == ids[0] && order[1] == ids[1] && order[2] == ids[2];
+    shared_memory[3] = wut_mutex_unlock(&mutex);
+
+    int producer = wut_create(producer_run);
+    int consumer = wut_create(consumer_run);
+    wut_join(producer);
+    wut_join(consumer);
+    shared_memory[4] = consumed == (long) ITEMS * (ITEMS + 1) / 2;
+    shared_memory[5] = wut_mutex_trylock(&mutex);
+    shared_memory[6] = wut_mutex_lock(&mutex);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "no thread should get a locked mutex"
+    );
+    expect(
+        shared_memory[1], 0, "the owner should be able to unlock"
+    );
+    expect(
+        shared_memory[2], 1, "waiters should get the mutex in FIFO order"
+    );
+    expect(
+        shared_memory[3], -1, "unlocking a mutex that isn't held should fail"
+    );
+    expect(
+        shared_memory[4], 1, "every item should be consumed exactly once"
+    );
+    expect(
+        shared_memory[5], 0, "trylock on a free mutex should succeed"
+    );
+    expect(
+        shared_memory[6], -1, "locking a mutex twice should fail"
+    );
+}
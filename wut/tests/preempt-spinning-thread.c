@@ -0,0 +1,43 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <stdatomic.h> // atomic_int
+
+static atomic_int stop;
+
+void spin_run(void) {
+    shared_memory[1] = wut_id();
+    while (!atomic_load(&stop)) {
+    }
+    wut_exit(5);
+}
+
+void test(void) {
+    shared_memory[0] = wut_set_quantum(1000);
+    wut_init();
+    int id = wut_create(spin_run);
+    // The spinning thread never yields, only preemption gets us back here
+    shared_memory[2] = wut_yield();
+    atomic_store(&stop, 1);
+    shared_memory[3] = wut_join(id);
+    shared_memory[4] = wut_set_quantum(0);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_set_quantum should be successful"
+    );
+    expect(
+        shared_memory[1], 1, "the spinning thread should have run"
+    );
+    expect(
+        shared_memory[2], 0, "wut_yield should be successful"
+    );
+    expect(
+        shared_memory[3], 5, "the spinning thread should exit after being preempted"
+    );
+    expect(
+        shared_memory[4], 0, "turning preemption off should be successful"
+    );
+}
@@ -0,0 +1,63 @@
+#include "test.h"
+
+#include "wut.h"
+
+static int order[3];
+static int order_count;
+
+void record_run(void) {
+    order[order_count++] = wut_id();
+}
+
+void test(void) {
+    wut_init();
+    int normal = wut_create(record_run);
+    int low = wut_create(record_run);
+
+    wut_attr attr;
+    wut_attr_init(&attr);
+    attr.priority = 2;
+    int high = wut_create_ex(record_run, &attr);
+    // It's already queued, it has to move to the back
+    shared_memory[0] = wut_set_priority(low, 12);
+
+    // The urgent thread goes first and then the queue is in FIFO order again,
+    // the normal thread was queued before we were
+    wut_yield();
+    shared_memory[1] = order_count;
+    shared_memory[2] = order[0] == high && order[1] == normal;
+    wut_join(low);
+    shared_memory[3] = order[2] == low;
+
+    shared_memory[4] = wut_get_priority(wut_id());
+    shared_memory[5] = wut_set_priority(wut_id(), WUT_PRIORITY_LEVELS);
+    shared_memory[6] = wut_set_priority(low, 0);
+    shared_memory[7] = wut_set_policy(WUT_SCHED_MLFQ);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_set_priority on a queued thread should succeed"
+    );
+    expect(
+        shared_memory[1], 2, "only the low priority thread should still wait"
+    );
+    expect(
+        shared_memory[2], 1, "the high priority thread should run first"
+    );
+    expect(
+        shared_memory[3], 1, "the low priority thread should run last"
+    );
+    expect(
+        shared_memory[4], WUT_PRIORITY_DEFAULT, "the main thread should have the default priority"
+    );
+    expect(
+        shared_memory[5], -1, "a priority out of range should fail"
+    );
+    expect(
+        shared_memory[6], -1, "an exited thread has no priority to set"
+    );
+    expect(
+        shared_memory[7], 0, "switching to the MLFQ should succeed"
+    );
+}
@@ -0,0 +1,274 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <dlfcn.h> // dlopen, dlsym
+#include <pthread.h> // pthread_create
+#include <errno.h> // EDEADLK, EINVAL, ETIMEDOUT
+#include <sched.h> // sched_yield
+#include <time.h> // clock_gettime
+
+#define THREADS 4
+#define ROUNDS 100
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int counter;
+static int done;
+static int not_wut;
+
+static void* add(void* arg) {
+    if (wut_id() <= 0) {
+        ++not_wut;
+    }
+    for (int i = 0; i < ROUNDS; ++i) {
+        pthread_mutex_lock(&lock);
+        int seen = counter;
+        // Anyone else trying to get in has to wait for us
+        sched_yield();
+        counter = seen + 1;
+        pthread_mutex_unlock(&lock);
+    }
+    pthread_mutex_lock(&lock);
+    ++done;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+    return (char*) arg + 1;
+}
+
+static void* signaller(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    ++done;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static wut_sem foreign_done;
+static pthread_t foreign_self;
+static int foreign_stable;
+static int task_self;
+
+// Started with wut_create rather than pthread_create
+static void foreign(void) {
+    foreign_self = pthread_self();
+    foreign_stable = foreign_self != 0 && pthread_equal(foreign_self, pthread_self());
+    wut_sem_wait(&foreign_done);
+}
+
+static void task(void* arg) {
+    (void) arg;
+    task_self = pthread_self() != 0;
+}
+
+static int timed_wait(long ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += ms * 1000000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    return pthread_cond_timedwait(&changed, &lock, &deadline);
+}
+
+// Started with libc's pthread_create, so it isn't a wut thread and its own
+// mutex and condition variable go to libc
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kernel_changed = PTHREAD_COND_INITIALIZER;
+static int kernel_id;
+static int kernel_waited;
+
+static void* kernel(void* arg) {
+    (void) arg;
+    kernel_id = wut_id();
+    sched_yield();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_mutex_lock(&kernel_lock);
+    kernel_waited = pthread_cond_timedwait(&kernel_changed, &kernel_lock, &deadline);
+    pthread_mutex_unlock(&kernel_lock);
+    return NULL;
+}
+
+static void* kernel_signaller(void* arg) {
+    (void) arg;
+    // Until the waiter has seen one
+    for (int waited = -1; waited == -1; sched_yield()) {
+        pthread_mutex_lock(&kernel_lock);
+        pthread_cond_signal(&kernel_changed);
+        waited = kernel_waited;
+        pthread_mutex_unlock(&kernel_lock);
+    }
+    return NULL;
+}
+
+// Waits 10 ms against a CLOCK_MONOTONIC deadline, true if it timed out on time
+static int monotonic_wait(pthread_cond_t* cond, int clockwait) {
+    struct timespec start, deadline, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    deadline.tv_nsec += 10 * 1000000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    pthread_mutex_lock(&lock);
+    int result = clockwait
+        ? pthread_cond_clockwait(cond, &lock, CLOCK_MONOTONIC, &deadline)
+        : pthread_cond_timedwait(cond, &lock, &deadline);
+    pthread_mutex_unlock(&lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    return result == ETIMEDOUT && ms >= 10;
+}
+
+static void* detached(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    ++done;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+    pthread_exit(NULL);
+}
+
+void test(void) {
+    static char args[THREADS];
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        shared_memory[0] = pthread_create(&threads[i], NULL, add, &args[i]);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    pthread_create(&thread, &attr, detached, NULL);
+
+    pthread_mutex_lock(&lock);
+    while (done < THREADS + 1) {
+        pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    int wrong = 0;
+    for (int i = 0; i < THREADS; ++i) {
+        void* result;
+        pthread_join(threads[i], &result);
+        if (result != &args[i] + 1) {
+            ++wrong;
+        }
+    }
+    shared_memory[1] = counter;
+    shared_memory[2] = wrong;
+    shared_memory[3] = not_wut;
+    shared_memory[4] = pthread_equal(pthread_self(), pthread_self()) != 0;
+    shared_memory[5] = pthread_join(pthread_self(), NULL);
+
+    pthread_mutex_lock(&lock);
+    shared_memory[6] = timed_wait(10);
+    shared_memory[7] = pthread_mutex_unlock(&lock);
+    pthread_mutex_lock(&lock);
+    done = 0;
+    pthread_create(&thread, NULL, signaller, NULL);
+    int result = 0;
+    while (done == 0 && result == 0) {
+        result = timed_wait(1000);
+    }
+    shared_memory[8] = result;
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    wut_sem_init(&foreign_done, 0);
+    int id = wut_create(foreign);
+    wut_yield();
+    shared_memory[9] = foreign_stable;
+    shared_memory[10] = pthread_join(foreign_self, NULL);
+    shared_memory[11] = pthread_detach(foreign_self);
+    wut_sem_post(&foreign_done);
+    wut_join(id);
+
+    wut_waitgroup wg;
+    wut_waitgroup_init(&wg);
+    wut_task_pool_start(1, 1);
+    wut_spawn_task(task, NULL, &wg);
+    wut_waitgroup_wait(&wg);
+    shared_memory[12] = task_self;
+
+    // Kernel threads the shim didn't start, waited for by libc
+    void* libc = dlopen("libc.so.6", RTLD_NOW);
+    int (*libc_create)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*);
+    int (*libc_join)(pthread_t, void**);
+    *(void**) &libc_create = dlsym(libc, "pthread_create");
+    *(void**) &libc_join = dlsym(libc, "pthread_join");
+    pthread_t waiter, waker;
+    kernel_waited = -1;
+    libc_create(&waiter, NULL, kernel, NULL);
+    libc_create(&waker, NULL, kernel_signaller, NULL);
+    libc_join(waiter, NULL);
+    libc_join(waker, NULL);
+    shared_memory[13] = kernel_id;
+    shared_memory[14] = kernel_waited;
+
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_t monotonic;
+    pthread_cond_init(&monotonic, &condattr);
+    pthread_condattr_destroy(&condattr);
+    shared_memory[15] = monotonic_wait(&monotonic, 0);
+    shared_memory[16] = monotonic_wait(&changed, 1);
+    pthread_cond_destroy(&monotonic);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "pthread_create should succeed"
+    );
+    expect(
+        shared_memory[1], THREADS * ROUNDS, "the mutex should keep increments from getting lost"
+    );
+    expect(
+        shared_memory[2], 0, "pthread_join should return what each thread returned"
+    );
+    expect(
+        shared_memory[3], 0, "every pthread should be a wut thread"
+    );
+    expect(
+        shared_memory[4], 1, "pthread_self should be stable"
+    );
+    expect(
+        shared_memory[5], EDEADLK, "joining yourself should fail"
+    );
+    expect(
+        shared_memory[6], ETIMEDOUT, "a timed wait nobody signals should time out"
+    );
+    expect(
+        shared_memory[7], 0, "a timed out wait should hold the mutex again"
+    );
+    expect(
+        shared_memory[8], 0, "a signalled timed wait should succeed"
+    );
+    expect(
+        shared_memory[9], 1, "pthread_self should be stable in a thread from wut_create"
+    );
+    expect(
+        shared_memory[10], EINVAL, "a thread from wut_create can't be joined as a pthread"
+    );
+    expect(
+        shared_memory[11], EINVAL, "a thread from wut_create can't be detached"
+    );
+    expect(
+        shared_memory[12], 1, "pthread_self should work in a task"
+    );
+    expect(
+        shared_memory[13], -1, "a kernel thread from libc shouldn't be a wut thread"
+    );
+    expect(
+        shared_memory[14], 0, "a kernel thread from libc should be signalled through libc"
+    );
+    expect(
+        shared_memory[15], 1, "a timed wait should use the condition variable's clock"
+    );
+    expect(
+        shared_memory[16], 1, "pthread_cond_clockwait should use the clock it's given"
+    );
+}
@@ -0,0 +1,38 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define NUM_ROUNDS 100000
+
+static int round_number = 0;
+
+void run(void) {
+    wut_exit(round_number & 0xFF);
+}
+
+void test(void) {
+    wut_init();
+    shared_memory[0] = 0;
+    shared_memory[1] = 0;
+    for (round_number = 0; round_number < NUM_ROUNDS; ++round_number) {
+        if (round_number == NUM_ROUNDS / 2) {
+            wut_set_cache_limit(0);
+        }
+        int id = wut_create(run);
+        if (id != 1) {
+            ++shared_memory[0];
+        }
+        if (wut_join(id) != (round_number & 0xFF)) {
+            ++shared_memory[1];
+        }
+    }
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "a joined thread's ID should be reused"
+    );
+    expect(
+        shared_memory[1], 0, "wut_join should return the status of each thread"
+    );
+}
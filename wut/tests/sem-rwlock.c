@@ -0,0 +1,97 @@
+#include "test.h"
+
+#include "wut.h"
+
+static wut_sem sem;
+static wut_rwlock rwlock;
+static int sem_taken;
+static int readers_inside;
+static int max_readers_inside;
+static int writer_saw_readers = -1;
+static int late_reader_saw_writer;
+static int writer_done;
+
+void sem_run(void) {
+    wut_sem_wait(&sem);
+    ++sem_taken;
+}
+
+void reader_run(void) {
+    wut_rwlock_rdlock(&rwlock);
+    ++readers_inside;
+    if (readers_inside > max_readers_inside) {
+        max_readers_inside = readers_inside;
+    }
+    wut_yield();
+    --readers_inside;
+    wut_rwlock_unlock(&rwlock);
+}
+
+void writer_run(void) {
+    wut_rwlock_wrlock(&rwlock);
+    writer_saw_readers = readers_inside;
+    wut_yield();
+    writer_done = 1;
+    wut_rwlock_unlock(&rwlock);
+}
+
+void late_reader_run(void) {
+    wut_rwlock_rdlock(&rwlock);
+    late_reader_saw_writer = writer_done;
+    wut_rwlock_unlock(&rwlock);
+}
+
+void test(void) {
+    wut_init();
+    wut_sem_init(&sem, 1);
+    wut_rwlock_init(&rwlock);
+
+    int sem_ids[3];
+    for (int i = 0; i < 3; ++i) {
+        sem_ids[i] = wut_create(sem_run);
+    }
+    wut_yield();
+    shared_memory[0] = sem_taken;
+    wut_sem_post(&sem);
+    wut_sem_post(&sem);
+    for (int i = 0; i < 3; ++i) {
+        wut_join(sem_ids[i]);
+    }
+    shared_memory[1] = sem_taken;
+
+    // Two readers get in together, the writer waits for both and the late
+    // reader waits for the writer
+    int ids[4];
+    ids[0] = wut_create(reader_run);
+    ids[1] = wut_create(reader_run);
+    ids[2] = wut_create(writer_run);
+    ids[3] = wut_create(late_reader_run);
+    for (int i = 0; i < 4; ++i) {
+        wut_join(ids[i]);
+    }
+    shared_memory[2] = max_readers_inside;
+    shared_memory[3] = writer_saw_readers;
+    shared_memory[4] = late_reader_saw_writer;
+    shared_memory[5] = wut_rwlock_unlock(&rwlock);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 1, "only one thread should get the semaphore"
+    );
+    expect(
+        shared_memory[1], 3, "every post should wake a waiter"
+    );
+    expect(
+        shared_memory[2], 2, "readers should share the lock"
+    );
+    expect(
+        shared_memory[3], 0, "the writer should have the lock to itself"
+    );
+    expect(
+        shared_memory[4], 1, "a reader shouldn't overtake a waiting writer"
+    );
+    expect(
+        shared_memory[5], -1, "unlocking a free rwlock should fail"
+    );
+}
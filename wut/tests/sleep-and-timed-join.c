@@ -0,0 +1,61 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <errno.h> // errno, ETIMEDOUT
+#include <time.h> // clock_gettime
+
+#define MS 1000000L
+
+static long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / MS;
+}
+
+void sleeper_run(void) {
+    wut_sleep_ns(30 * MS);
+    wut_exit(4);
+}
+
+void test(void) {
+    struct timespec start;
+    wut_init();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Alone, the sleep has to happen in the kernel
+    shared_memory[0] = wut_sleep_ns(5 * MS);
+    shared_memory[1] = elapsed_ms(&start) >= 5;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int id = wut_create(sleeper_run);
+    shared_memory[2] = wut_join_timeout(id, 10 * MS);
+    shared_memory[3] = errno;
+    long waited = elapsed_ms(&start);
+    shared_memory[4] = waited >= 10 && waited < 30;
+    shared_memory[5] = wut_join_timeout(id, 1000 * MS);
+    shared_memory[6] = elapsed_ms(&start) >= 30;
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_sleep_ns should be successful"
+    );
+    expect(
+        shared_memory[1], 1, "wut_sleep_ns shouldn't end early"
+    );
+    expect(
+        shared_memory[2], -1, "the first join should time out"
+    );
+    expect(
+        shared_memory[3], ETIMEDOUT, "a timed out join should set ETIMEDOUT"
+    );
+    expect(
+        shared_memory[4], 1, "the first join should wait for its timeout only"
+    );
+    expect(
+        shared_memory[5], 4, "the second join should get the exit status"
+    );
+    expect(
+        shared_memory[6], 1, "the sleeper shouldn't wake up early"
+    );
+}
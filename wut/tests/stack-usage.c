@@ -0,0 +1,70 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define FRAME_SIZE 4096
+#define KiB 1024
+
+static wut_sem sem;
+
+static int recurse(int depth) {
+    volatile char frame[FRAME_SIZE];
+    frame[0] = (char) depth;
+    frame[FRAME_SIZE - 1] = (char) depth;
+    if (depth == 0) {
+        return frame[0] + frame[FRAME_SIZE - 1];
+    }
+    return recurse(depth - 1) + 1 + frame[0] - frame[FRAME_SIZE - 1];
+}
+
+void deep_run(void) {
+    recurse(10);
+}
+
+void waiting_run(void) {
+    recurse(3);
+    wut_sem_wait(&sem);
+}
+
+void test(void) {
+    wut_init();
+    wut_sem_init(&sem, 0);
+    shared_memory[0] = wut_stack_usage_start(-1);
+
+    wut_join(wut_create(deep_run));
+    // Gets the same stack from the cache, which was emptied
+    int id = wut_create(waiting_run);
+    wut_yield();
+    shared_memory[1] = (int) (wut_stack_peak(id) / KiB);
+    wut_sem_post(&sem);
+    wut_join(id);
+    shared_memory[2] = (int) wut_stack_peak(0);
+
+    wut_stack_histogram hist;
+    wut_get_stack_histogram(&hist);
+    shared_memory[3] = (int) hist.threads;
+    shared_memory[4] = (int) (hist.max / KiB);
+    // 44 KiB or more, the waiting thread stayed under 32 KiB
+    shared_memory[5] = (int) hist.buckets[4];
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "measuring stack usage should start"
+    );
+    expect(
+        shared_memory[1] >= 16 && shared_memory[1] <= 32, 1, "a waiting thread should show what it used so far"
+    );
+    expect(
+        shared_memory[2], -1, "the main thread has no wut stack"
+    );
+    expect(
+        shared_memory[3], 2, "both threads should be measured"
+    );
+    expect(
+        shared_memory[4] >= 44 && shared_memory[4] <= 64, 1, "the deepest thread should set the maximum"
+    );
+    expect(
+        shared_memory[5], 1, "the deepest thread should land in the 64 KiB bucket"
+    );
+}
@@ -0,0 +1,65 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define POOL_THREADS 4
+#define QUEUE_SIZE 8
+#define TASKS 100
+
+static int sum;
+static int ran_on[TASKS];
+
+void add(void * arg) {
+    int i = (int) (long) arg;
+    sum += i;
+    ran_on[i] = wut_id();
+    // Let the other pool threads take tasks too
+    wut_yield();
+}
+
+void test(void) {
+    wut_init();
+    wut_waitgroup wg;
+    wut_waitgroup_init(&wg);
+    // Nothing to wait for yet
+    shared_memory[0] = wut_waitgroup_wait(&wg);
+    shared_memory[1] = wut_task_pool_start(POOL_THREADS, QUEUE_SIZE);
+    shared_memory[2] = wut_task_pool_start(POOL_THREADS, QUEUE_SIZE);
+
+    // More tasks than fit in the queue, spawning waits for room
+    for (int i = 0; i < TASKS; ++i) {
+        wut_spawn_task(add, (void*) (long) i, &wg);
+    }
+    wut_waitgroup_wait(&wg);
+    shared_memory[3] = sum;
+
+    int outside = 0;
+    for (int i = 0; i < TASKS; ++i) {
+        if (ran_on[i] < 1 || ran_on[i] > POOL_THREADS) {
+            ++outside;
+        }
+    }
+    shared_memory[4] = outside;
+    shared_memory[5] = wut_waitgroup_done(&wg);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "waiting on an empty wait group should return at once"
+    );
+    expect(
+        shared_memory[1], 0, "starting the pool should succeed"
+    );
+    expect(
+        shared_memory[2], -1, "the pool can only be started once"
+    );
+    expect(
+        shared_memory[3], TASKS * (TASKS - 1) / 2, "every task should run before the wait returns"
+    );
+    expect(
+        shared_memory[4], 0, "tasks should only run on the pool's threads"
+    );
+    expect(
+        shared_memory[5], -1, "a wait group can't go below zero"
+    );
+}
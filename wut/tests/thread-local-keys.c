@@ -0,0 +1,93 @@
+#include "test.h"
+
+#include "wut.h"
+
+#define THREADS 4
+
+static wut_key key;
+static int values[THREADS + 2];
+static int destroyed;
+static int wrong;
+
+void destroy(void * value) {
+    shared_memory[6] = ++destroyed;
+    // Setting a value again gets it destroyed in another round
+    if (value == &values[0]) {
+        wut_setspecific(key, &values[1]);
+    }
+}
+
+void run(void) {
+    int id = wut_id();
+    if (wut_getspecific(key) != NULL) {
+        ++wrong;
+    }
+    wut_setspecific(key, &values[id]);
+    // The others set their own value in between
+    wut_yield();
+    if (wut_getspecific(key) != &values[id]) {
+        ++wrong;
+    }
+}
+
+void blocked_run(void) {
+    wut_setspecific(key, &values[THREADS + 1]);
+    wut_join(0);
+}
+
+void test(void) {
+    wut_init();
+    shared_memory[0] = wut_key_create(&key, destroy);
+    wut_setspecific(key, &values[0]);
+
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        ids[i] = wut_create(run);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        wut_join(ids[i]);
+    }
+    shared_memory[1] = wrong;
+    shared_memory[2] = destroyed;
+
+    // Cancelled while blocked, the destructor runs in the cancelling thread
+    int blocked = wut_create(blocked_run);
+    wut_yield();
+    wut_cancel(blocked);
+    wut_join(blocked);
+    shared_memory[3] = destroyed;
+
+    // Recycled TCBs start out empty
+    int id = wut_create(run);
+    wut_join(id);
+    shared_memory[4] = wrong;
+    shared_memory[5] = wut_setspecific(key + 1, NULL);
+
+    // Our own value, and the one the destructor sets, go on exit
+    destroyed = 0;
+    wut_exit(0);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "creating a key should succeed"
+    );
+    expect(
+        shared_memory[1], 0, "every thread should see only its own value"
+    );
+    expect(
+        shared_memory[2], THREADS, "every exiting thread should destroy its value"
+    );
+    expect(
+        shared_memory[3], THREADS + 1, "a cancelled thread should destroy its value"
+    );
+    expect(
+        shared_memory[4], 0, "a recycled thread should start without a value"
+    );
+    expect(
+        shared_memory[5], -1, "setting a key that wasn't created should fail"
+    );
+    expect(
+        shared_memory[6], 2, "a value set by a destructor should be destroyed too"
+    );
+}
@@ -0,0 +1,62 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <stdatomic.h> // atomic_int
+
+#define WORKERS 4
+#define THREADS 8
+#define ROUNDS 1000000
+
+static wut_key key;
+static int values[THREADS + 1][2];
+static atomic_int started;
+static atomic_int wrong;
+
+void run(void) {
+    int id = wut_id();
+    atomic_fetch_add(&started, 1);
+    // More threads than workers, and none of them yields, so they only all
+    // get this far by being preempted
+    while (atomic_load(&started) < THREADS) {
+    }
+    for (int i = 0; i < ROUNDS; ++i) {
+        wut_setspecific(key, &values[id][i & 1]);
+        // Preempted in between, the thread may go on on another worker
+        if (wut_getspecific(key) != &values[id][i & 1] || wut_id() != id) {
+            atomic_fetch_add(&wrong, 1);
+        }
+    }
+}
+
+void test(void) {
+    shared_memory[0] = wut_set_quantum(200);
+    shared_memory[1] = wut_init_workers(WORKERS);
+    wut_key_create(&key, NULL);
+
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        ids[i] = wut_create(run);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        wut_join(ids[i]);
+    }
+    shared_memory[2] = atomic_load(&started);
+    shared_memory[3] = atomic_load(&wrong);
+    wut_set_quantum(0);
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_set_quantum should be successful"
+    );
+    expect(
+        shared_memory[1], 0, "wut_init_workers should be successful"
+    );
+    expect(
+        shared_memory[2], THREADS, "every thread should have run"
+    );
+    expect(
+        shared_memory[3], 0, "a preempted thread should only ever see its own value"
+    );
+}
@@ -0,0 +1,83 @@
+#include "test.h"
+
+#include "wut.h"
+
+#include <stdio.h> // fopen
+#include <stdlib.h> // mkstemp
+#include <string.h> // strstr
+#include <unistd.h> // close, unlink
+
+#define ROUNDS 100
+
+void yield_run(void) {
+    for (int i = 0; i < ROUNDS; ++i) {
+        wut_yield();
+    }
+}
+
+void test(void) {
+    wut_init();
+    shared_memory[0] = wut_trace_start(1024);
+    int first = wut_create(yield_run);
+    int second = wut_create(yield_run);
+    // Let both finish, but don't join them yet, joining drops the counters
+    while (wut_yield() == 0) {
+    }
+    wut_trace_stop();
+
+    wut_stats stats;
+    shared_memory[1] = wut_get_stats(first, &stats);
+    shared_memory[2] = stats.switches == ROUNDS + 1;
+    shared_memory[3] = stats.cpu_ns > 0 && stats.runnable_ns > 0;
+    wut_get_stats(second, &stats);
+    shared_memory[4] = stats.switches == ROUNDS + 1;
+    wut_join(first);
+    wut_join(second);
+    shared_memory[5] = wut_get_stats(first, &stats);
+
+    char path[] = "/tmp/wut-trace-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    shared_memory[6] = wut_trace_dump(path);
+    char buffer[4096] = { 0 };
+    FILE * in = fopen(path, "r");
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, in);
+    fclose(in);
+    unlink(path);
+    shared_memory[7] = length > 0 && strstr(buffer, "\"traceEvents\"") != NULL;
+    shared_memory[8] = strstr(buffer, "\"name\":\"thread 1\",\"ph\":\"X\"") != NULL;
+    shared_memory[9] = strstr(buffer, "\"name\":\"create 2\"") != NULL;
+}
+
+void check(void) {
+    expect(
+        shared_memory[0], 0, "wut_trace_start should be successful"
+    );
+    expect(
+        shared_memory[1], 0, "an exited thread should still have its counters"
+    );
+    expect(
+        shared_memory[2], 1, "the thread should be switched to once per yield plus its start"
+    );
+    expect(
+        shared_memory[3], 1, "the thread should have spent time running and waiting"
+    );
+    expect(
+        shared_memory[4], 1, "both threads should be counted"
+    );
+    expect(
+        shared_memory[5], -1, "a joined thread has no counters"
+    );
+    expect(
+        shared_memory[6], 0, "wut_trace_dump should be successful"
+    );
+    expect(
+        shared_memory[7], 1, "the dump should be a Chrome trace"
+    );
+    expect(
+        shared_memory[8], 1, "the dump should have slices for thread 1"
+    );
+    expect(
+        shared_memory[9], 1, "the dump should have the creation of thread 2"
+    );
+}